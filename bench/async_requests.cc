@@ -0,0 +1,400 @@
+// Drives many concurrent OSS requests through HttpEngine against a local
+// stand-in of the OSS HTTP interface, to show how many requests a couple of
+// event loop threads keep in flight and what the throughput is. Every
+// coroutine sends list, head, ranged get, put and upload part requests one
+// after another, signed as for OSS.
+
+#include "async_task.h"
+#include "http_engine.h"
+#include "oss_request.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t kObjectSize = 64 * 1024;
+constexpr size_t kRangeSize = 4096;
+constexpr const char *kKeyId = "bench-key";
+
+/**
+ * A single threaded HTTP/1.1 server answering like OSS: list results for a
+ * GET of the bucket, object ranges, heads and uploads. It only checks that
+ * requests carry an OSS signature of the bench key.
+ */
+class StandIn {
+public:
+    StandIn() {
+        listener_ = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener_, reinterpret_cast<sockaddr *>(&addr),
+                 sizeof(addr)) != 0 ||
+            listen(listener_, 1024) != 0) {
+            std::perror("stand-in");
+            std::exit(1);
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(listener_, reinterpret_cast<sockaddr *>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+        fcntl(listener_, F_SETFL, O_NONBLOCK);
+        thread_ = std::thread(&StandIn::Run, this);
+    }
+
+    ~StandIn() {
+        stopped_ = true;
+        thread_.join();
+        for (auto &conn : conns_) {
+            close(conn.fd);
+        }
+        close(listener_);
+    }
+
+    int port() const { return port_; }
+
+    size_t requests() const { return requests_; }
+
+private:
+    struct Conn {
+        int fd;
+        std::string in;
+        std::string out;
+    };
+
+    void Run() {
+        while (!stopped_) {
+            std::vector<pollfd> fds{{listener_, POLLIN, 0}};
+            for (auto &conn : conns_) {
+                short events = POLLIN;
+                if (!conn.out.empty()) {
+                    events |= POLLOUT;
+                }
+                fds.push_back({conn.fd, events, 0});
+            }
+            if (poll(fds.data(), fds.size(), 100) <= 0) {
+                continue;
+            }
+            if (fds[0].revents & POLLIN) {
+                int fd;
+                while ((fd = accept(listener_, nullptr, nullptr)) >= 0) {
+                    fcntl(fd, F_SETFL, O_NONBLOCK);
+                    conns_.push_back({fd, "", ""});
+                }
+            }
+            std::vector<Conn> alive;
+            for (size_t i = 1; i < fds.size(); i++) {
+                Conn &conn = conns_[i - 1];
+                if (Serve(conn, fds[i].revents)) {
+                    alive.push_back(std::move(conn));
+                } else {
+                    close(conn.fd);
+                }
+            }
+            // Connections accepted in this turn have no pollfd yet.
+            for (size_t i = fds.size() - 1; i < conns_.size(); i++) {
+                alive.push_back(std::move(conns_[i]));
+            }
+            conns_.swap(alive);
+        }
+    }
+
+    // Returns false once the connection is closed.
+    bool Serve(Conn &conn, short revents) {
+        if (revents & (POLLIN | POLLHUP | POLLERR)) {
+            char buf[64 * 1024];
+            for (;;) {
+                ssize_t n = read(conn.fd, buf, sizeof(buf));
+                if (n > 0) {
+                    conn.in.append(buf, n);
+                } else if (n == 0) {
+                    return false;
+                } else {
+                    break;
+                }
+            }
+            while (HandleRequest(conn)) {
+            }
+        }
+        while (!conn.out.empty()) {
+            ssize_t n = write(conn.fd, conn.out.data(), conn.out.size());
+            if (n <= 0) {
+                break;
+            }
+            conn.out.erase(0, n);
+        }
+        return true;
+    }
+
+    // Answer the first request buffered in conn, if it is complete.
+    bool HandleRequest(Conn &conn) {
+        size_t end = conn.in.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            return false;
+        }
+        std::string head = conn.in.substr(0, end);
+        std::map<std::string, std::string> headers;
+        size_t pos = head.find("\r\n");
+        std::string line = head.substr(0, pos);
+        while (pos != std::string::npos) {
+            size_t next = head.find("\r\n", pos + 2);
+            std::string header = head.substr(pos + 2, next - pos - 2);
+            size_t colon = header.find(':');
+            if (colon != std::string::npos) {
+                std::string name = header.substr(0, colon);
+                for (auto &c : name) {
+                    c = std::tolower(c);
+                }
+                headers[name] = header.substr(
+                        header.find_first_not_of(' ', colon + 1));
+            }
+            pos = next;
+        }
+        size_t length = std::strtoul(headers["content-length"].c_str(),
+                                     nullptr, 10);
+        if (conn.in.size() < end + 4 + length) {
+            return false;
+        }
+        conn.in.erase(0, end + 4 + length);
+        requests_++;
+
+        std::string method = line.substr(0, line.find(' '));
+        std::string target = line.substr(method.size() + 1);
+        target = target.substr(0, target.find(' '));
+        std::string status = "200 OK", extra, body;
+        if (headers["authorization"].compare(
+                    0, std::strlen(kKeyId) + 5,
+                    std::string("OSS ") + kKeyId + ":") != 0) {
+            status = "403 Forbidden";
+            body = "<Error><Code>AccessDenied</Code>"
+                   "<Message>no signature</Message></Error>";
+        } else if (method == "HEAD") {
+            extra = "ETag: \"0123456789ABCDEF0123456789ABCDEF\"\r\n"
+                    "Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT\r\n"
+                    "x-oss-meta-userETag: 0123456789abcdef\r\n";
+            conn.out += "HTTP/1.1 200 OK\r\nContent-Length: " +
+                        std::to_string(kObjectSize) + "\r\n" + extra +
+                        "\r\n";
+            return true;
+        } else if (method == "GET" &&
+                   target.find("delimiter=") != std::string::npos) {
+            body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+                   "<ListBucketResult><Name>bucket</Name>"
+                   "<IsTruncated>false</IsTruncated>"
+                   "<CommonPrefixes><Prefix>dir/sub/</Prefix>"
+                   "</CommonPrefixes>";
+            for (int i = 0; i < 16; i++) {
+                body += "<Contents><Key>dir/file" + std::to_string(i) +
+                        "</Key><LastModified>2015-10-21T07:28:00.000Z"
+                        "</LastModified><ETag>&quot;0123456789ABCDEF"
+                        "0123456789ABCDEF&quot;</ETag><Size>" +
+                        std::to_string(kObjectSize) + "</Size></Contents>";
+            }
+            body += "</ListBucketResult>";
+        } else if (method == "GET") {
+            size_t begin = 0, last = kObjectSize - 1;
+            std::sscanf(headers["range"].c_str(), "bytes=%zu-%zu", &begin,
+                        &last);
+            status = "206 Partial Content";
+            body.assign(last - begin + 1, 'x');
+        } else if (method == "PUT") {
+            extra = "ETag: \"0123456789ABCDEF0123456789ABCDEF\"\r\n";
+        }
+        conn.out += "HTTP/1.1 " + status +
+                    "\r\nContent-Length: " + std::to_string(body.size()) +
+                    "\r\n" + extra + "\r\n" + body;
+        return true;
+    }
+
+    int listener_;
+    int port_;
+    std::atomic<bool> stopped_{false};
+    std::atomic<size_t> requests_{0};
+    std::vector<Conn> conns_;
+    std::thread thread_;
+};
+
+struct Counters {
+    std::atomic<size_t> ok{0};
+    std::atomic<size_t> failed{0};
+};
+
+AsyncTask<void> Send(HttpEngine &engine,
+                     HttpRequest &request,
+                     HttpResponse &response,
+                     Counters &counters,
+                     long expected) {
+    co_await engine.Perform(request, response);
+    if (response.code == expected) {
+        counters.ok++;
+    } else {
+        if (counters.failed++ == 0) {
+            std::fprintf(stderr, "%s %s: %s\n", request.method.c_str(),
+                         request.url.c_str(),
+                         OssErrorMessage(response).c_str());
+        }
+    }
+}
+
+// One client sending rounds of the five kinds of requests in turn.
+AsyncTask<void> Client(HttpEngine &engine,
+                       const OssEndpoint &endpoint,
+                       int fd,
+                       size_t rounds,
+                       Counters &counters) {
+    for (size_t i = 0; i < rounds; i++) {
+        {
+            HttpRequest request;
+            SignOssRequest(request, endpoint, "bucket", "",
+                           {{"prefix", "dir/"}, {"delimiter", "/"}});
+            HttpResponse response;
+            co_await Send(engine, request, response, counters, 200);
+            OssListPage page;
+            if (!ParseOssListPage(response.body, page) ||
+                page.objects.size() != 16) {
+                counters.failed++;
+            }
+        }
+        {
+            HttpRequest request;
+            request.method = "HEAD";
+            SignOssRequest(request, endpoint, "bucket", "dir/file0");
+            HttpResponse response;
+            co_await Send(engine, request, response, counters, 200);
+        }
+        {
+            HttpRequest request;
+            request.headers.push_back("Range: bytes=0-" +
+                                      std::to_string(kRangeSize - 1));
+            SignOssRequest(request, endpoint, "bucket", "dir/file0");
+            size_t received = 0;
+            request.onData = [&received](const char *, size_t size) {
+                received += size;
+                return true;
+            };
+            HttpResponse response;
+            co_await Send(engine, request, response, counters, 206);
+            if (received != kRangeSize) {
+                counters.failed++;
+            }
+        }
+        {
+            HttpRequest request;
+            request.method = "PUT";
+            request.body.assign(kRangeSize, 'y');
+            SignOssRequest(request, endpoint, "bucket", "dir/put");
+            HttpResponse response;
+            co_await Send(engine, request, response, counters, 200);
+        }
+        {
+            HttpRequest request;
+            request.method = "PUT";
+            request.bodyFd = fd;
+            request.bodyOffset = kRangeSize;
+            request.bodySize = kRangeSize;
+            SignOssRequest(request, endpoint, "bucket", "dir/part",
+                           {{"partNumber", "2"}, {"uploadId", "bench"}});
+            HttpResponse response;
+            co_await Send(engine, request, response, counters, 200);
+        }
+    }
+}
+
+AsyncTask<void> RunClients(std::vector<AsyncTask<void>> &clients) {
+    co_await WhenAll(clients);
+}
+
+int ThreadCount() {
+    std::ifstream ifs("/proc/self/status");
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return std::atoi(line.c_str() + 8);
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    size_t loops = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2;
+
+    char path[] = "/tmp/async_requests.XXXXXX";
+    int fd = mkstemp(path);
+    std::string content(2 * kRangeSize, 'z');
+    if (fd < 0 || write(fd, content.data(), content.size()) !=
+                          ssize_t(content.size())) {
+        std::perror("temporary file");
+        return 1;
+    }
+    unlink(path);
+
+    StandIn standIn;
+    OssEndpoint endpoint;
+    endpoint.host = "oss-bench.aliyuncs.com";
+    endpoint.keyId = kKeyId;
+    endpoint.keySecret = "bench-secret";
+    endpoint.scheme = "http";
+    endpoint.connectTo = "127.0.0.1:" + std::to_string(standIn.port());
+
+    for (size_t concurrency = 1; concurrency <= 4096; concurrency *= 8) {
+        HttpEngine engine(loops, 64);
+        Counters counters;
+        size_t rounds = std::max<size_t>(requests / 5 / concurrency, 1);
+        std::vector<AsyncTask<void>> clients;
+        for (size_t i = 0; i < concurrency; i++) {
+            clients.push_back(Client(engine, endpoint, fd, rounds, counters));
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::atomic<int> threads{0};
+        std::atomic<size_t> inFlight{0};
+        std::atomic<bool> done{false};
+        std::thread sampler([&]() {
+            while (!done) {
+                threads = std::max(threads.load(), ThreadCount());
+                inFlight = std::max(inFlight.load(), engine.active());
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        });
+        SyncWait(RunClients(clients));
+        std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+        done = true;
+        sampler.join();
+        size_t total = counters.ok + counters.failed;
+        std::printf("loops=%-2zu coroutines=%-5zu %8.3fs %10.0f requests/s "
+                    "in flight<=%-5zu threads<=%-3d failed=%zu\n",
+                    loops,
+                    concurrency,
+                    elapsed.count(),
+                    total / elapsed.count(),
+                    inFlight.load(),
+                    // Less the sampler itself.
+                    threads.load() - 1,
+                    counters.failed.load());
+        if (counters.failed) {
+            return 1;
+        }
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,155 @@
+// Measures matching the entries of two listings by name, as CompareDirectory
+// does, from 1k to 10M entries per side:
+//   map    the former way, a std::map of each side and a lookup per entry
+//   merge  SortedByName of each side and one MergeByName pass
+// Both listings come directories first like GetLocalDir and ListObjects,
+// with a tenth of directories and a tenth of the names on one side only.
+// Results are printed as one JSON array, to be compared between builds.
+//
+//   directory_merge [max entries] [max entries for map]
+
+#include "directory_merge.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Millis(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// Directories first, each part sorted, skipping the names of one side.
+std::vector<FilePtr> Listing(size_t n, size_t skip) {
+    std::vector<FilePtr> files;
+    files.reserve(n + 1);
+    auto parent = std::make_shared<File>();
+    parent->name = "..";
+    parent->type = FTDirectory;
+    files.push_back(parent);
+    for (FileType type : {FTDirectory, FTFile}) {
+        for (size_t i = 0; i < n; i++) {
+            bool dir = i % 10 == 3;
+            if ((type == FTDirectory) != dir || i % 20 == skip) {
+                continue;
+            }
+            char name[32];
+            std::snprintf(name, sizeof(name), "entry_%09zu", i);
+            auto file = std::make_shared<File>();
+            file->name = name;
+            file->type = type;
+            file->stat.size = i;
+            files.push_back(file);
+        }
+    }
+    return files;
+}
+
+// Names on both sides with the same size, and names on one side only.
+struct Counts {
+    size_t same{0};
+    size_t single{0};
+
+    bool operator==(const Counts &) const = default;
+};
+
+Counts MatchByMap(const std::vector<FilePtr> &l,
+                  const std::vector<FilePtr> &r) {
+    std::map<std::string, const FilePtr &> lfiles;
+    for (const auto &file : l) {
+        if (file->name != "..") {
+            lfiles.emplace(file->name, file);
+        }
+    }
+    std::map<std::string, const FilePtr &> rfiles;
+    for (const auto &file : r) {
+        if (file->name != "..") {
+            rfiles.emplace(file->name, file);
+        }
+    }
+    Counts counts;
+    for (auto &[name, lfile] : lfiles) {
+        auto it = rfiles.find(name);
+        if (it == rfiles.end()) {
+            counts.single++;
+        } else if (lfile->stat.size == it->second->stat.size) {
+            counts.same++;
+        }
+    }
+    for (auto &[name, rfile] : rfiles) {
+        if (lfiles.count(name) == 0) {
+            counts.single++;
+        }
+    }
+    return counts;
+}
+
+Counts MatchByMerge(const std::vector<FilePtr> &l,
+                    const std::vector<FilePtr> &r) {
+    Counts counts;
+    MergeByName(l,
+                SortedByName(l),
+                r,
+                SortedByName(r),
+                [&](size_t li, size_t ri) {
+                    if (li == kNoFile || ri == kNoFile) {
+                        counts.single++;
+                    } else if (l[li]->stat.size == r[ri]->stat.size) {
+                        counts.same++;
+                    }
+                });
+    return counts;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t max = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+    size_t mapMax = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+
+    bool first = true;
+    bool ok = true;
+    for (size_t n = 1000; n <= max; n *= 10) {
+        std::vector<FilePtr> l = Listing(n, 7);
+        std::vector<FilePtr> r = Listing(n, 11);
+
+        auto start = Clock::now();
+        Counts merged = MatchByMerge(l, r);
+        double mergeMs = Millis(Clock::now() - start);
+
+        double mapMs = -1;
+        if (n <= mapMax) {
+            start = Clock::now();
+            Counts mapped = MatchByMap(l, r);
+            mapMs = Millis(Clock::now() - start);
+            ok = ok && mapped == merged;
+        }
+
+        std::printf("%s\n  {\"entries\": %zu, \"same\": %zu, "
+                    "\"single\": %zu, \"merge_ms\": %.3f, "
+                    "\"merge_ns_per_entry\": %.1f",
+                    first ? "[" : ",",
+                    n,
+                    merged.same,
+                    merged.single,
+                    mergeMs,
+                    mergeMs * 1e6 / n);
+        if (mapMs >= 0) {
+            std::printf(", \"map_ms\": %.3f, \"map_ns_per_entry\": %.1f",
+                        mapMs,
+                        mapMs * 1e6 / n);
+        }
+        std::printf("}");
+        std::fflush(stdout);
+        first = false;
+    }
+    std::printf("%s\n]\n", first ? "[" : "");
+    return ok ? 0 : 1;
+}
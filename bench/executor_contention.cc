@@ -0,0 +1,177 @@
+// Submits many tiny tasks from several producers and measures how long the
+// executor takes to drain them, to compare the single queue of
+// ScheduledThreadPoolExecutor with the deques of WorkStealingExecutor.
+// The taskptr and range scenarios submit closures holding a shared_ptr like
+// TaskList does, one by one and with submit_range.
+
+#include "executor.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace {
+
+struct Result {
+    double seconds;
+    double tasksPerSecond;
+};
+
+Result Run(Executor *executor, size_t producers, size_t tasks) {
+    std::atomic<size_t> done{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    size_t perProducer = tasks / producers;
+    for (size_t p = 0; p < producers; p++) {
+        threads.emplace_back([executor, perProducer, &done]() {
+            for (size_t i = 0; i < perProducer; i++) {
+                executor->submit([&done]() { done++; });
+            }
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    while (done < perProducer * producers) {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), perProducer * producers / elapsed.count()};
+}
+
+struct Item {
+    size_t value;
+};
+
+// Like TaskList::Submit, a closure of this and a TaskPtr per task.
+Result RunTaskPtr(Executor *executor,
+                  const std::vector<std::shared_ptr<Item>> &items,
+                  bool range) {
+    std::atomic<size_t> done{0};
+    auto start = std::chrono::steady_clock::now();
+    if (range) {
+        executor->submit_range(
+                Executor::kBulk,
+                items.begin(),
+                items.end(),
+                [&done](const std::shared_ptr<Item> &item) {
+                    done += item->value;
+                });
+    } else {
+        for (const auto &item : items) {
+            executor->submit(Executor::kBulk,
+                             [&done, item]() { done += item->value; });
+        }
+    }
+    while (done < items.size()) {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), items.size() / elapsed.count()};
+}
+
+// Tasks which submit their follow ups, as TaskList::Submit(TaskPtrVec) does
+// from inside the pool.
+Result RunNested(Executor *executor, size_t fanout, size_t tasks) {
+    std::atomic<size_t> done{0};
+    auto start = std::chrono::steady_clock::now();
+    size_t batches = tasks / fanout;
+    for (size_t b = 0; b < batches; b++) {
+        executor->submit([executor, fanout, &done]() {
+            for (size_t i = 0; i < fanout; i++) {
+                executor->submit([&done]() { done++; });
+            }
+        });
+    }
+    while (done < batches * fanout) {
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), batches * fanout / elapsed.count()};
+}
+
+void Print(const char *name,
+           const char *scenario,
+           size_t threads,
+           size_t producers,
+           const Result &r) {
+    std::printf("%-28s %-8s threads=%-3zu producers=%-3zu %8.3fs %12.0f "
+                "tasks/s\n",
+                name,
+                scenario,
+                threads,
+                producers,
+                r.seconds,
+                r.tasksPerSecond);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t tasks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    size_t hw = std::max(2u, std::thread::hardware_concurrency());
+
+    for (size_t threads : {size_t(4), hw}) {
+        for (size_t producers : {size_t(1), size_t(4)}) {
+            {
+                ScheduledThreadPoolExecutor executor(threads, threads, threads);
+                Print("ScheduledThreadPoolExecutor",
+                      "flat",
+                      threads,
+                      producers,
+                      Run(&executor, producers, tasks));
+            }
+            {
+                WorkStealingExecutor executor(threads);
+                Print("WorkStealingExecutor",
+                      "flat",
+                      threads,
+                      producers,
+                      Run(&executor, producers, tasks));
+            }
+        }
+        {
+            ScheduledThreadPoolExecutor executor(threads, threads, threads);
+            Print("ScheduledThreadPoolExecutor",
+                  "nested",
+                  threads,
+                  0,
+                  RunNested(&executor, 100, tasks));
+        }
+        {
+            WorkStealingExecutor executor(threads);
+            Print("WorkStealingExecutor",
+                  "nested",
+                  threads,
+                  0,
+                  RunNested(&executor, 100, tasks));
+        }
+        std::vector<std::shared_ptr<Item>> items;
+        for (size_t i = 0; i < tasks; i++) {
+            items.push_back(std::make_shared<Item>(Item{1}));
+        }
+        for (bool range : {false, true}) {
+            {
+                ScheduledThreadPoolExecutor executor(threads, threads, threads);
+                Print("ScheduledThreadPoolExecutor",
+                      range ? "range" : "taskptr",
+                      threads,
+                      1,
+                      RunTaskPtr(&executor, items, range));
+            }
+            {
+                WorkStealingExecutor executor(threads);
+                Print("WorkStealingExecutor",
+                      range ? "range" : "taskptr",
+                      threads,
+                      1,
+                      RunTaskPtr(&executor, items, range));
+            }
+        }
+    }
+    return 0;
+}
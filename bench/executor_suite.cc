@@ -0,0 +1,308 @@
+// Measures every executor across thread counts and task granularities:
+//   throughput  submit tasks from one producer and drain them
+//   wakeup      submit one task to an idle executor, time until it starts
+//   burst       bursts of tasks with pauses between, submitted one by one
+//               and with submit_range, time to drain a burst and the
+//               threads started for them
+//   reap        after the bursts, time until the extra threads exited
+// Results are printed as one JSON array, to be compared between builds.
+//
+//   executor_suite [tasks] [executor]
+
+#include "executor.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Micros(Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+// Keep the thread busy for granularity, as a task doing that much work.
+void Work(Clock::duration granularity) {
+    if (granularity == Clock::duration::zero()) {
+        return;
+    }
+    auto end = Clock::now() + granularity;
+    while (Clock::now() < end) {
+    }
+}
+
+double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t index = std::min(values.size() - 1,
+                            static_cast<size_t>(p * values.size()));
+    return values[index];
+}
+
+void WaitFor(const std::atomic<size_t> &done, size_t n) {
+    while (done < n) {
+        std::this_thread::yield();
+    }
+}
+
+struct Config {
+    const char *executor;
+    size_t threads;
+    Clock::duration granularity;
+};
+
+class Report {
+public:
+    // Start a result object, fields are added with Field until End.
+    void Begin(const Config &config, const char *benchmark) {
+        std::printf("%s\n  {\"executor\": \"%s\", \"threads\": %zu, "
+                    "\"granularity_us\": %.0f, \"benchmark\": \"%s\"",
+                    first_ ? "[" : ",",
+                    config.executor,
+                    config.threads,
+                    Micros(config.granularity),
+                    benchmark);
+        first_ = false;
+    }
+
+    void Field(const char *name, const char *value) {
+        std::printf(", \"%s\": \"%s\"", name, value);
+    }
+
+    void Field(const char *name, double value) {
+        std::printf(", \"%s\": %.3f", name, value);
+    }
+
+    void Field(const char *name, uint64_t value) {
+        std::printf(", \"%s\": %llu", name, (unsigned long long)value);
+    }
+
+    void End() {
+        std::printf("}");
+        std::fflush(stdout);
+    }
+
+    void Close() { std::printf("%s\n]\n", first_ ? "[" : ""); }
+
+private:
+    bool first_{true};
+};
+
+void Throughput(Executor *executor,
+                const Config &config,
+                size_t tasks,
+                Report &report) {
+    std::atomic<size_t> done{0};
+    auto start = Clock::now();
+    for (size_t i = 0; i < tasks; i++) {
+        executor->submit(Executor::kBulk, [&done, &config]() {
+            Work(config.granularity);
+            done++;
+        });
+    }
+    auto submitted = Clock::now();
+    WaitFor(done, tasks);
+    auto elapsed = Clock::now() - start;
+
+    report.Begin(config, "throughput");
+    report.Field("tasks", uint64_t(tasks));
+    report.Field("submit_ns_per_task",
+                 Micros(submitted - start) * 1000 / tasks);
+    report.Field("seconds", Micros(elapsed) / 1e6);
+    report.Field("tasks_per_second", tasks / (Micros(elapsed) / 1e6));
+    report.End();
+}
+
+void Wakeup(Executor *executor,
+            const Config &config,
+            size_t samples,
+            Report &report) {
+    std::vector<double> latencies;
+    for (size_t i = 0; i < samples; i++) {
+        // Long enough for the workers to block, short of the idle timeout.
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        std::atomic<size_t> done{0};
+        auto submitted = Clock::now();
+        Clock::time_point started;
+        executor->submit(Executor::kInteractive, [&done, &started]() {
+            started = Clock::now();
+            done++;
+        });
+        WaitFor(done, 1);
+        latencies.push_back(Micros(started - submitted));
+    }
+
+    report.Begin(config, "wakeup");
+    report.Field("samples", uint64_t(samples));
+    report.Field("p50_us", Percentile(latencies, 0.5));
+    report.Field("p99_us", Percentile(latencies, 0.99));
+    report.Field("max_us", Percentile(latencies, 1));
+    report.End();
+}
+
+void BurstAndReap(Executor *executor,
+                  const Config &config,
+                  size_t bursts,
+                  size_t burstSize,
+                  bool range,
+                  Report &report) {
+    const ExecutorStats &stats = executor->stats();
+    uint64_t threadsBefore = stats.threadsStarted;
+    size_t peakThreads = 0;
+    std::vector<double> drains;
+    std::vector<double> waits;
+    std::mutex waitsMtx;
+    std::vector<size_t> items(burstSize);
+    for (size_t b = 0; b < bursts; b++) {
+        std::atomic<size_t> done{0};
+        auto start = Clock::now();
+        auto task = [&](size_t) {
+            double wait = Micros(Clock::now() - start);
+            Work(config.granularity);
+            {
+                std::lock_guard<std::mutex> lck(waitsMtx);
+                waits.push_back(wait);
+            }
+            done++;
+        };
+        if (range) {
+            executor->submit_range(
+                    Executor::kBulk, items.begin(), items.end(), task);
+        } else {
+            for (size_t item : items) {
+                executor->submit(Executor::kBulk, task, item);
+            }
+        }
+        WaitFor(done, burstSize);
+        drains.push_back(Micros(Clock::now() - start));
+        peakThreads = std::max(peakThreads, stats.threads());
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    const char *submit = range ? "range" : "each";
+    report.Begin(config, "burst");
+    report.Field("submit", submit);
+    report.Field("bursts", uint64_t(bursts));
+    report.Field("burst_size", uint64_t(burstSize));
+    report.Field("drain_p50_us", Percentile(drains, 0.5));
+    report.Field("drain_max_us", Percentile(drains, 1));
+    report.Field("wait_p50_us", Percentile(waits, 0.5));
+    report.Field("wait_p99_us", Percentile(waits, 0.99));
+    report.Field("threads_started",
+                 uint64_t(stats.threadsStarted - threadsBefore));
+    report.Field("peak_threads", uint64_t(peakThreads));
+    report.End();
+
+    // Threads beyond the reserve of ScheduledThreadPoolExecutor exit after
+    // its idle time, the others keep theirs. Wait until none exited for a
+    // while.
+    size_t before = stats.threads();
+    size_t threads = before;
+    auto start = Clock::now();
+    auto lastExit = start;
+    while (Clock::now() - lastExit < std::chrono::milliseconds(300)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        size_t now = stats.threads();
+        if (now < threads) {
+            threads = now;
+            lastExit = Clock::now();
+        }
+    }
+    report.Begin(config, "reap");
+    report.Field("submit", submit);
+    report.Field("threads_before", uint64_t(before));
+    report.Field("threads_after", uint64_t(threads));
+    report.Field("reap_ms", Micros(lastExit - start) / 1000);
+    report.End();
+}
+
+struct Factory {
+    const char *name;
+    // One thread whatever the count, so only the first count is run.
+    bool singleThread;
+    std::function<std::unique_ptr<Executor>(size_t threads)> create;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t tasks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    const char *only = argc > 2 ? argv[2] : nullptr;
+
+    std::vector<Factory> factories = {
+            {"single", true,
+             [](size_t) { return std::make_unique<SingleThreadExecutor>(); }},
+            {"fixed", false,
+             [](size_t threads) {
+                 return std::make_unique<FixedThreadPoolExecutor>(threads);
+             }},
+            {"scheduled", false,
+             [](size_t threads) {
+                 // One reserved thread, the others are started for bursts
+                 // and reaped after a short idle time.
+                 return std::make_unique<ScheduledThreadPoolExecutor>(
+                         1, threads, 0, std::chrono::milliseconds(50));
+             }},
+            {"work_stealing", false,
+             [](size_t threads) {
+                 return std::make_unique<WorkStealingExecutor>(threads);
+             }},
+    };
+    std::vector<size_t> threadCounts = {1, 4, 16};
+    std::vector<Clock::duration> granularities = {
+            Clock::duration::zero(),
+            std::chrono::microseconds(1),
+            std::chrono::microseconds(50),
+    };
+
+    Report report;
+    for (const auto &factory : factories) {
+        if (only && std::strcmp(only, factory.name) != 0) {
+            continue;
+        }
+        for (size_t threads : threadCounts) {
+            if (factory.singleThread && threads != threadCounts.front()) {
+                continue;
+            }
+            for (auto granularity : granularities) {
+                Config config{factory.name, threads, granularity};
+                // About a fifth of a second of work per thread at most.
+                size_t n = tasks;
+                if (granularity > Clock::duration::zero()) {
+                    n = std::min<size_t>(
+                            n,
+                            std::chrono::milliseconds(200) * threads /
+                                    granularity);
+                }
+                {
+                    auto executor = factory.create(threads);
+                    Throughput(executor.get(), config, n, report);
+                }
+                {
+                    auto executor = factory.create(threads);
+                    Wakeup(executor.get(), config, 200, report);
+                }
+                for (bool range : {false, true}) {
+                    auto executor = factory.create(threads);
+                    BurstAndReap(executor.get(),
+                                 config,
+                                 20,
+                                 std::min<size_t>(64 * threads, n),
+                                 range,
+                                 report);
+                }
+            }
+        }
+    }
+    report.Close();
+    return 0;
+}
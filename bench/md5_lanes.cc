@@ -0,0 +1,118 @@
+// Measures the MD5 kernels against each other and against OpenSSL, hashing
+// many buffers of one size as the compare of a folder does with its files:
+//   for each buffer size, every kernel of this CPU hashes the same buffers
+//   through Md5Buffers, and OpenSSL hashes them one after another
+// Digests are checked against OpenSSL. Results are printed as one JSON
+// array, to be compared between builds and CPUs.
+//
+//   md5_lanes [megabytes per size]
+
+#include "md5.h"
+
+#include <openssl/evp.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Seconds(Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+}
+
+std::vector<Md5::Digest> OpenSslDigests(
+        const std::vector<std::string_view> &buffers) {
+    std::vector<Md5::Digest> digests(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        EVP_Digest(buffers[i].data(),
+                   buffers[i].size(),
+                   digests[i].data(),
+                   nullptr,
+                   EVP_md5(),
+                   nullptr);
+    }
+    return digests;
+}
+
+void Print(bool &first,
+           const char *kernel,
+           size_t lanes,
+           size_t bufferSize,
+           size_t buffers,
+           double seconds,
+           bool ok) {
+    std::printf("%s\n  {\"kernel\": \"%s\", \"lanes\": %zu, "
+                "\"buffer_size\": %zu, \"buffers\": %zu, \"seconds\": %.4f, "
+                "\"mb_per_second\": %.1f, \"ok\": %s}",
+                first ? "[" : ",",
+                kernel,
+                lanes,
+                bufferSize,
+                buffers,
+                seconds,
+                bufferSize * buffers / seconds / (1 << 20),
+                ok ? "true" : "false");
+    std::fflush(stdout);
+    first = false;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    std::vector<size_t> sizes = {4 << 10, 64 << 10, 1 << 20, 16 << 20};
+
+    std::mt19937_64 rng(1);
+    std::string data(megabytes << 20, '\0');
+    for (size_t i = 0; i + 8 <= data.size(); i += 8) {
+        uint64_t v = rng();
+        std::memcpy(&data[i], &v, 8);
+    }
+
+    bool first = true;
+    bool allOk = true;
+    for (size_t size : sizes) {
+        std::vector<std::string_view> buffers;
+        for (size_t off = 0; off + size <= data.size(); off += size) {
+            buffers.emplace_back(data.data() + off, size);
+        }
+        if (buffers.empty()) {
+            continue;
+        }
+
+        auto start = Clock::now();
+        std::vector<Md5::Digest> expected = OpenSslDigests(buffers);
+        Print(first,
+              "openssl",
+              1,
+              size,
+              buffers.size(),
+              Seconds(Clock::now() - start),
+              true);
+
+        for (const Md5Kernel &kernel : Md5Kernels()) {
+            start = Clock::now();
+            std::vector<Md5::Digest> digests = Md5Buffers(buffers, kernel);
+            double seconds = Seconds(Clock::now() - start);
+            bool ok = digests == expected;
+            allOk = allOk && ok;
+            Print(first,
+                  kernel.name,
+                  kernel.lanes,
+                  size,
+                  buffers.size(),
+                  seconds,
+                  ok);
+        }
+    }
+    std::printf("%s\n]\n", first ? "[" : "");
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// Hands items from producer threads to consumer threads through a queue and
+// measures the throughput, to compare the mutex based BlockingQueue with the
+// lock free MpmcQueue, one item at a time and in batches.
+
+#include "blocking_queue.h"
+#include "mpmc_queue.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+constexpr size_t kBatch = 32;
+
+struct Result {
+    double seconds;
+    double itemsPerSecond;
+};
+
+// Starts pairs producers and as many consumers, every producer pushes
+// items / pairs values, the consumers pop until the queue is shut down.
+template <typename Producer, typename Consumer, typename Shutdown>
+Result Run(size_t pairs,
+           size_t items,
+           Producer produce,
+           Consumer consume,
+           Shutdown shutdown) {
+    size_t perProducer = items / pairs;
+    std::vector<std::thread> producers;
+    std::vector<std::thread> consumers;
+    std::atomic<size_t> popped{0};
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pairs; i++) {
+        consumers.emplace_back([&]() { popped += consume(); });
+    }
+    for (size_t i = 0; i < pairs; i++) {
+        producers.emplace_back([&]() { produce(perProducer); });
+    }
+    for (auto &th : producers) {
+        th.join();
+    }
+    shutdown();
+    for (auto &th : consumers) {
+        th.join();
+    }
+    std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+    if (popped != perProducer * pairs) {
+        std::fprintf(stderr, "lost items: %zu of %zu\n", popped.load(),
+                     perProducer * pairs);
+        std::exit(1);
+    }
+    return {elapsed.count(), popped / elapsed.count()};
+}
+
+Result RunBlockingQueue(size_t pairs, size_t items) {
+    BlockingQueue<size_t> q;
+    return Run(
+            pairs,
+            items,
+            [&q](size_t n) {
+                for (size_t i = 0; i < n; i++) {
+                    q.push(i);
+                }
+            },
+            [&q]() {
+                size_t n = 0, v;
+                while (q.pop(v) == BlockingQueue<size_t>::kOk) {
+                    n++;
+                }
+                return n;
+            },
+            [&q]() { q.shutdown(); });
+}
+
+Result RunMpmcQueue(size_t pairs, size_t items) {
+    MpmcQueue<size_t> q(1024);
+    return Run(
+            pairs,
+            items,
+            [&q](size_t n) {
+                for (size_t i = 0; i < n; i++) {
+                    q.push(i);
+                }
+            },
+            [&q]() {
+                size_t n = 0, v;
+                while (q.pop(v) == MpmcQueue<size_t>::kOk) {
+                    n++;
+                }
+                return n;
+            },
+            [&q]() { q.shutdown(); });
+}
+
+Result RunMpmcQueueBulk(size_t pairs, size_t items) {
+    MpmcQueue<size_t> q(1024);
+    return Run(
+            pairs,
+            items,
+            [&q](size_t n) {
+                std::vector<size_t> batch;
+                for (size_t i = 0; i < n; i += kBatch) {
+                    batch.clear();
+                    for (size_t j = i; j < n && j < i + kBatch; j++) {
+                        batch.push_back(j);
+                    }
+                    q.push_bulk(batch.begin(), batch.end());
+                }
+            },
+            [&q]() {
+                size_t n = 0, popped;
+                std::vector<size_t> batch(kBatch);
+                while (q.pop_bulk(batch.begin(), batch.size(), &popped) ==
+                       MpmcQueue<size_t>::kOk) {
+                    n += popped;
+                }
+                return n;
+            },
+            [&q]() { q.shutdown(); });
+}
+
+void Print(const char *name, size_t pairs, const Result &r) {
+    std::printf("%-16s producers=%-3zu consumers=%-3zu %8.3fs %12.0f "
+                "items/s\n",
+                name,
+                pairs,
+                pairs,
+                r.seconds,
+                r.itemsPerSecond);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t items = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    for (size_t pairs = 1; pairs <= 64; pairs *= 2) {
+        Print("BlockingQueue", pairs, RunBlockingQueue(pairs, items));
+        Print("MpmcQueue", pairs, RunMpmcQueue(pairs, items));
+        Print("MpmcQueue bulk", pairs, RunMpmcQueueBulk(pairs, items));
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "executor.h"
+
+template <typename T = void>
+class AsyncTask;
+
+namespace async_detail {
+
+// Resumes whoever awaited the finished coroutine, in the same thread.
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        std::coroutine_handle<> next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    AsyncTask<T> get_return_object();
+
+    template <typename U>
+    void return_value(U &&v) {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    AsyncTask<void> get_return_object();
+
+    void return_void() {}
+
+    void result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+// A coroutine nobody awaits, which frees itself when it finishes.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+} // namespace async_detail
+
+/**
+ * The result of a coroutine. The coroutine starts once the task is awaited,
+ * and the awaiting coroutine resumes in the thread it finished in, which for
+ * HTTP requests is an event loop thread of HttpEngine.
+ */
+template <typename T>
+class AsyncTask {
+public:
+    using promise_type = async_detail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    AsyncTask() = default;
+
+    explicit AsyncTask(Handle handle) : handle_(handle) {}
+
+    AsyncTask(AsyncTask &&other) noexcept
+        : handle_(std::exchange(other.handle_, {})) {}
+
+    AsyncTask &operator=(AsyncTask &&other) noexcept {
+        if (this != &other) {
+            Destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+
+    AsyncTask(const AsyncTask &) = delete;
+    AsyncTask &operator=(const AsyncTask &) = delete;
+
+    ~AsyncTask() { Destroy(); }
+
+    bool done() const { return !handle_ || handle_.done(); }
+
+    // The result of a finished task, or rethrow what escaped the coroutine.
+    T result() { return handle_.promise().result(); }
+
+    auto operator co_await() noexcept { return Awaiter{handle_, true}; }
+
+    // Await the task without taking its result, which result() returns later.
+    auto WhenDone() noexcept { return Awaiter{handle_, false}; }
+
+private:
+    struct Awaiter {
+        Handle handle;
+        bool takeResult;
+
+        bool await_ready() const noexcept { return !handle || handle.done(); }
+
+        std::coroutine_handle<> await_suspend(
+                std::coroutine_handle<> awaiting) noexcept {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume() {
+            if (takeResult) {
+                return handle.promise().result();
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return T();
+            }
+        }
+    };
+
+    void Destroy() {
+        if (handle_) {
+            handle_.destroy();
+            handle_ = {};
+        }
+    }
+
+    Handle handle_;
+};
+
+template <typename T>
+AsyncTask<T> async_detail::Promise<T>::get_return_object() {
+    return AsyncTask<T>(AsyncTask<T>::Handle::from_promise(*this));
+}
+
+inline AsyncTask<void> async_detail::Promise<void>::get_return_object() {
+    return AsyncTask<void>(AsyncTask<void>::Handle::from_promise(*this));
+}
+
+/**
+ * Run task and block the calling thread until it finished. Never call it in
+ * an event loop thread, the task may need that very thread to finish.
+ */
+template <typename T>
+T SyncWait(AsyncTask<T> task) {
+    std::promise<void> finished;
+    [](AsyncTask<T> &task,
+       std::promise<void> &finished) -> async_detail::Detached {
+        co_await task.WhenDone();
+        finished.set_value();
+    }(task, finished);
+    finished.get_future().wait();
+    return task.result();
+}
+
+/**
+ * Start all of tasks at once and resume when every one finished, their
+ * results are then read with result().
+ */
+template <typename T>
+AsyncTask<void> WhenAll(std::vector<AsyncTask<T>> &tasks) {
+    struct Awaiter {
+        explicit Awaiter(std::vector<AsyncTask<T>> &tasks) : tasks(tasks) {}
+
+        std::vector<AsyncTask<T>> &tasks;
+        // One more than the running tasks until all were started, so the
+        // last task to finish cannot resume before await_suspend returns.
+        std::atomic<size_t> remaining{0};
+        std::coroutine_handle<> awaiting;
+
+        bool await_ready() const noexcept { return tasks.empty(); }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            awaiting = h;
+            remaining = tasks.size() + 1;
+            for (auto &task : tasks) {
+                [](AsyncTask<T> &task, Awaiter &self) -> async_detail::Detached {
+                    co_await task.WhenDone();
+                    if (--self.remaining == 0) {
+                        self.awaiting.resume();
+                    }
+                }(task, *this);
+            }
+            return --remaining != 0;
+        }
+
+        void await_resume() noexcept {}
+    };
+    co_await Awaiter(tasks);
+}
+
+/**
+ * Continue the awaiting coroutine as a task of executor, to move work off an
+ * event loop thread. The coroutine is lost if the executor drops the task.
+ */
+inline auto ResumeOn(Executor *executor,
+                     Executor::Priority priority = Executor::kBackground) {
+    struct Awaiter {
+        Executor *executor;
+        Executor::Priority priority;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            executor->submit(priority, [h]() { h.resume(); });
+        }
+
+        void await_resume() noexcept {}
+    };
+    return Awaiter{executor, priority};
+}
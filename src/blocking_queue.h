@@ -7,7 +7,7 @@
 
 template <typename T> class BlockingQueue {
 public:
-    enum Status { kOk, kEmpty, kShutdown, kTerminated };
+    enum Status { kOk, kEmpty, kFull, kShutdown, kTerminated };
     Status push(T &&v) {
         std::lock_guard<std::mutex> lck(mtx_);
         if (status_ >= kShutdown) {
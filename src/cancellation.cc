@@ -0,0 +1,6 @@
+#include "cancellation.h"
+
+CancellationToken &shutdownToken() {
+    static CancellationToken token;
+    return token;
+}
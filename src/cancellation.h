@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+/**
+ * A flag shared by the code asking a piece of work to stop and the work
+ * itself, which polls it at points where stopping leaves consistent state.
+ * Copies share the flag. A child token also reads as cancelled once any of
+ * its ancestors is, but resetting it only clears its own flag.
+ */
+class CancellationToken {
+public:
+    CancellationToken() : state_(std::make_shared<State>()) {}
+
+    CancellationToken child() const {
+        CancellationToken token;
+        token.state_->parent = state_;
+        return token;
+    }
+
+    void cancel() { state_->cancelled = true; }
+
+    void reset() { state_->cancelled = false; }
+
+    bool cancelled() const {
+        for (const State *s = state_.get(); s; s = s->parent.get()) {
+            if (s->cancelled.load(std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct State {
+        std::atomic<bool> cancelled{false};
+        std::shared_ptr<State> parent;
+    };
+
+    std::shared_ptr<State> state_;
+};
+
+// Cancelled when the application is closing, the root of all task tokens.
+CancellationToken &shutdownToken();
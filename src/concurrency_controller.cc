@@ -0,0 +1,77 @@
+#include "concurrency_controller.h"
+
+#include <algorithm>
+
+ConcurrencyController::ConcurrencyController(const std::string &name,
+                                             WorkStealingExecutor *executor,
+                                             size_t min,
+                                             size_t max)
+    : name_(name),
+      executor_(executor),
+      min_(std::max<size_t>(min, 1)),
+      max_(std::max(std::min(max, executor->max_concurrency()), min_)),
+      windowStart_(Clock::now()) {
+    executor_->set_concurrency(
+            std::clamp(executor_->concurrency(), min_, max_));
+}
+
+void ConcurrencyController::AddBytes(size_t bytes) {
+    std::lock_guard<std::mutex> lck(mtx_);
+    bytes_ += bytes;
+    Update(Clock::now());
+}
+
+void ConcurrencyController::AddResult(bool failed) {
+    std::lock_guard<std::mutex> lck(mtx_);
+    finished_++;
+    if (failed) {
+        failed_++;
+    }
+    Update(Clock::now());
+}
+
+size_t ConcurrencyController::concurrency() const {
+    return executor_->concurrency();
+}
+
+void ConcurrencyController::Update(Clock::time_point now) {
+    auto elapsed = now - windowStart_;
+    if (elapsed < kWindow) {
+        return;
+    }
+    double rate = bytes_ / std::chrono::duration<double>(elapsed).count();
+    size_t current = executor_->concurrency();
+
+    if (failed_ > 0 && failed_ >= kErrorRate * finished_) {
+        if (current > min_) {
+            Apply(std::max(current / 2, min_));
+        }
+        lastIncreased_ = false;
+        hold_ = kHoldWindows;
+    } else if (bytes_ > 0) {
+        if (lastIncreased_ && rate < lastRate_ * (1 + kMinGain)) {
+            Apply(current - 1);
+            lastIncreased_ = false;
+            hold_ = kHoldWindows;
+        } else if (hold_ > 0) {
+            hold_--;
+            lastIncreased_ = false;
+        } else if (current < max_ && executor_->stats().queued() > 0) {
+            Apply(current + 1);
+            lastIncreased_ = true;
+        } else {
+            lastIncreased_ = false;
+        }
+        lastRate_ = rate;
+    }
+
+    // Idle windows leave everything as it is.
+    windowStart_ = now;
+    bytes_ = 0;
+    finished_ = 0;
+    failed_ = 0;
+}
+
+void ConcurrencyController::Apply(size_t concurrency) {
+    executor_->set_concurrency(concurrency);
+}
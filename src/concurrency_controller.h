@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "executor.h"
+
+/**
+ * Tunes how many workers of a transfer pool run at once, additive increase
+ * and multiplicative decrease on the bytes per second the pool moves. After
+ * every window with traffic it adds a worker while throughput keeps growing
+ * and tasks are waiting, takes the last one back when it brought nothing,
+ * and halves the workers when too many tasks of the window failed, which is
+ * how throttling and timeouts of the servers show.
+ */
+class ConcurrencyController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Keep the concurrency of executor in [min, max], max is also clamped to
+    // the threads of executor.
+    ConcurrencyController(const std::string &name,
+                          WorkStealingExecutor *executor,
+                          size_t min,
+                          size_t max);
+
+    // Bytes moved by tasks of the executor.
+    void AddBytes(size_t bytes);
+
+    // A task of the executor finished or failed.
+    void AddResult(bool failed);
+
+    size_t concurrency() const;
+
+private:
+    void Update(Clock::time_point now);
+    void Apply(size_t concurrency);
+
+    // Length of a window, long enough to see a whole part of a large file.
+    static constexpr std::chrono::seconds kWindow{3};
+    // An added worker has to raise the throughput by this much to stay.
+    static constexpr double kMinGain = 0.05;
+    // Halve the workers when this share of the finished tasks failed.
+    static constexpr double kErrorRate = 0.1;
+    // Windows to wait before trying to grow again after an increase was
+    // taken back or the workers were halved.
+    static constexpr int kHoldWindows = 5;
+
+    const std::string name_;
+    WorkStealingExecutor *executor_;
+    const size_t min_;
+    const size_t max_;
+
+    mutable std::mutex mtx_;
+    Clock::time_point windowStart_;
+    size_t bytes_{0};
+    size_t finished_{0};
+    size_t failed_{0};
+    // Throughput of the last window with traffic, in bytes per second.
+    double lastRate_{0};
+    bool lastIncreased_{false};
+    int hold_{0};
+};
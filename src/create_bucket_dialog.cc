@@ -91,7 +91,7 @@ CreateBucketDialog::CreateBucketDialog(OssSite *site, wxWindow *parent)
 }
 
 void CreateBucketDialog::OnOk(wxCommandEvent &event) {
-    globalExecutor()->submit([this]() {
+    globalExecutor()->submit(Executor::kInteractive, [this]() {
         std::string name = nameInput_->GetValue().ToStdString();
         const std::vector<const char *> &regionCodes = ossRegionCodes();
         std::string region = regionCodes[region_->GetSelection() + 1];
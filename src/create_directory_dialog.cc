@@ -38,7 +38,7 @@ CreateDirectoryDialog::CreateDirectoryDialog(Site *site, wxWindow *parent)
 }
 
 void CreateDirectoryDialog::OnOk(wxCommandEvent &event) {
-    globalExecutor()->submit([this]() {
+    globalExecutor()->submit(Executor::kInteractive, [this]() {
         std::string name = textCtrl_->GetValue().ToStdString();
         Status status =
                 site_->MakeDir(Site::Combine(site_->GetCurrentPath(), name));
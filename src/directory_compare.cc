@@ -1,12 +1,313 @@
 #include "directory_compare.h"
+#include "directory_merge.h"
 #include "global_executor.h"
+#include "hash_service.h"
+#include "options.h"
+#include "oss_site.h"
 
 #include <wx/wxprec.h>
 #ifndef WX_PRECOMP
 #include <wx/wx.h>
 #endif
 
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+/**
+ * What comparing found of one listing: the results by index of file, and
+ * the ETags fetched for the files compared by content but listed without.
+ */
+struct CompareSide {
+    std::vector<CmpResult> cmps;
+    std::unordered_map<size_t, std::string> etags;
+};
+
+// Indexes of the entries of a name on either side, kNoFile if not listed.
+using IndexPairs = std::vector<std::pair<size_t, size_t>>;
+
+/**
+ * A compared pair of listings, their orders by name and what was found of
+ * them. The next compare of the pair takes the results of the names listed
+ * the same on both sides from here.
+ */
+struct Comparison {
+    std::string lsite;
+    std::string lpath;
+    std::string rsite;
+    std::string rpath;
+    bool checkContent{true};
+    DirPtr ldir;
+    DirPtr rdir;
+    std::vector<size_t> lorder;
+    std::vector<size_t> rorder;
+    CompareSide l;
+    CompareSide r;
+};
+
+constexpr size_t kComparisonCap = 8;
+
+// The latest comparisons first, used in main thread only.
+std::list<Comparison> &comparisons() {
+    static std::list<Comparison> inst;
+    return inst;
+}
+
+bool SamePair(const Comparison &l, const Comparison &r) {
+    return l.lsite == r.lsite && l.lpath == r.lpath && l.rsite == r.rsite &&
+           l.rpath == r.rpath && l.checkContent == r.checkContent;
+}
+
+// Take the comparison of the pair of key out, an empty one if none.
+Comparison TakeComparison(const Comparison &key) {
+    auto &list = comparisons();
+    for (auto it = list.begin(); it != list.end(); ++it) {
+        if (SamePair(*it, key)) {
+            Comparison comparison = std::move(*it);
+            list.erase(it);
+            return comparison;
+        }
+    }
+    return {};
+}
+
+void RememberComparison(Comparison &&comparison) {
+    auto &list = comparisons();
+    list.remove_if([&comparison](const Comparison &c) {
+        return SamePair(c, comparison);
+    });
+    list.push_front(std::move(comparison));
+    if (list.size() > kComparisonCap) {
+        list.pop_back();
+    }
+}
+
+// The index of the entry named name of dir, looked for in order from k on.
+// k is left there, so names must be looked for in order.
+size_t Seek(const DirPtr &dir,
+            const std::vector<size_t> &order,
+            size_t &k,
+            const std::string &name) {
+    while (k < order.size() && dir->files[order[k]]->name < name) {
+        k++;
+    }
+    if (k < order.size() && dir->files[order[k]]->name == name) {
+        return order[k];
+    }
+    return kNoFile;
+}
+
+// Whether entry i of dir is listed as entry prev of prevDir, or neither is.
+bool Unchanged(const DirPtr &dir,
+               size_t i,
+               const DirPtr &prevDir,
+               size_t prev) {
+    if (i == kNoFile || prev == kNoFile) {
+        return i == prev;
+    }
+    const File &file = *dir->files[i];
+    const File &old = *prevDir->files[prev];
+    return file.type == old.type && file.stat.size == old.stat.size &&
+           file.stat.lastModifiedTime == old.stat.lastModifiedTime &&
+           file.stat.etag == old.stat.etag &&
+           file.stat.partETag == old.stat.partETag;
+}
+
+// The ETag of file i of dir, the listed one or the one fetched to side.
+const std::string &ETagOf(const DirPtr &dir,
+                          const CompareSide &side,
+                          size_t i) {
+    static const std::string none;
+    const std::string &etag = dir->files[i]->stat.etag;
+    if (!etag.empty()) {
+        return etag;
+    }
+    auto it = side.etags.find(i);
+    return it == side.etags.end() ? none : it->second;
+}
+
+// Files differing in content, the newer one is the update.
+void CompareByTime(const File &lfile,
+                   const File &rfile,
+                   CmpResult &lcmp,
+                   CmpResult &rcmp) {
+    if (lfile.stat.lastModifiedTime < rfile.stat.lastModifiedTime) {
+        lcmp = CSOutdated;
+        rcmp = CSUpdated;
+    } else {
+        lcmp = CSUpdated;
+        rcmp = CSOutdated;
+    }
+}
+
+// Whether other lists the multipart ETag cached for file of the local site
+// when it was uploaded, which spares both hashing and a HEAD request.
+bool SamePartETag(const SitePtr &site,
+                  const DirPtr &dir,
+                  const File &file,
+                  const File &other) {
+    if (site->type() != STLocal || other.stat.partETag.empty()) {
+        return false;
+    }
+    std::string partETag;
+    return hashService()->CachedPartETag(dir->path + file.name, partETag) &&
+           partETag == other.stat.partETag;
+}
+
+// Take the next of indexes and HEAD its file until none is left.
+AsyncTask<void> HeadFiles(OssSite *site,
+                          const DirPtr &dir,
+                          const std::vector<size_t> &indexes,
+                          std::vector<std::string> &etags,
+                          std::atomic<size_t> &next) {
+    for (size_t i = next++; i < indexes.size(); i = next++) {
+        FileStat stat;
+        std::string userETag;
+        Status status = co_await site->HeadObjectAsync(
+                dir->path + dir->files[indexes[i]]->name, stat, userETag);
+        if (status.ok()) {
+            etags[i] = std::move(userETag);
+        }
+    }
+}
+
+/**
+ * Fetch to side the ETag GetETag gives each of the files indexes of the OSS
+ * directory dir, with at most OPTION_ENDPOINT_CONCURRENCY HEAD requests in
+ * flight. Their permits count against the endpoint with the transfers.
+ */
+void HeadETags(OssSite *site,
+               const DirPtr &dir,
+               const std::vector<size_t> &indexes,
+               CompareSide &side) {
+    size_t concurrency = std::min<size_t>(
+            std::max(options().get_int(OPTION_ENDPOINT_CONCURRENCY), 1),
+            indexes.size());
+    std::vector<std::string> etags(indexes.size());
+    std::atomic<size_t> next{0};
+    std::vector<AsyncTask<void>> heads;
+    for (size_t i = 0; i < concurrency; i++) {
+        heads.push_back(HeadFiles(site, dir, indexes, etags, next));
+    }
+    SyncWait(WhenAll(heads));
+    for (size_t i = 0; i < indexes.size(); i++) {
+        if (!etags[i].empty()) {
+            side.etags[indexes[i]] = std::move(etags[i]);
+        }
+    }
+}
+
+// Compare the entries of pairs, reading the listings only, the results and
+// ETags to l and r. Non-zero if any differ or directories are left.
+int ComparePairs(const SitePtr &lsite,
+                 const DirPtr &ldir,
+                 CompareSide &l,
+                 const SitePtr &rsite,
+                 const DirPtr &rdir,
+                 CompareSide &r,
+                 const IndexPairs &pairs,
+                 bool checkContent) {
+    int rc = 0;
+
+    IndexPairs sameSize;
+    for (const auto &[li, ri] : pairs) {
+        if (li == kNoFile || ri == kNoFile) {
+            (li == kNoFile ? r.cmps[ri] : l.cmps[li]) = CSNew;
+            rc = 1;
+            continue;
+        }
+        const File &lfile = *ldir->files[li];
+        const File &rfile = *rdir->files[ri];
+        if (lfile.type != rfile.type) {
+            l.cmps[li] = r.cmps[ri] = CSConflict;
+            rc = 1;
+        } else if (lfile.type == FTDirectory) {
+            // 文件夹结果为None，但需要进一步比较，所以rc=1
+            l.cmps[li] = r.cmps[ri] = CSNone;
+            rc = 1;
+        } else if (checkContent) {
+            if (lfile.stat.size != rfile.stat.size) {
+                CompareByTime(lfile, rfile, l.cmps[li], r.cmps[ri]);
+                rc = 1;
+            } else if (SamePartETag(lsite, ldir, lfile, rfile) ||
+                       SamePartETag(rsite, rdir, rfile, lfile)) {
+                l.cmps[li] = r.cmps[ri] = CSEqual;
+            } else {
+                sameSize.emplace_back(li, ri);
+            }
+        }
+    }
+
+    /*
+     * Files of the same size are compared by ETag. Local files are hashed on
+     * the hash service while this thread waits for the HEAD requests of the
+     * remote ones, sent concurrently, then the hashes are collected.
+     */
+    std::vector<size_t> lneeds, rneeds;
+    for (const auto &[li, ri] : sameSize) {
+        if (ETagOf(ldir, l, li).empty()) {
+            lneeds.push_back(li);
+        }
+        if (ETagOf(rdir, r, ri).empty()) {
+            rneeds.push_back(ri);
+        }
+    }
+    using Hashing =
+            std::tuple<CompareSide *, size_t, std::shared_future<std::string>>;
+    std::vector<Hashing> hashing;
+    auto startHashes = [&hashing](const SitePtr &site,
+                                  const DirPtr &dir,
+                                  CompareSide &side,
+                                  const std::vector<size_t> &needs) {
+        if (site->type() != STLocal || needs.empty()) {
+            return;
+        }
+        std::vector<std::string> paths;
+        for (size_t i : needs) {
+            paths.push_back(dir->path + dir->files[i]->name);
+        }
+        auto etags = hashService()->ContentETags(paths);
+        for (size_t i = 0; i < needs.size(); i++) {
+            hashing.emplace_back(&side, needs[i], etags[i]);
+        }
+    };
+    startHashes(lsite, ldir, l, lneeds);
+    startHashes(rsite, rdir, r, rneeds);
+    if (lsite->type() == STOss && !lneeds.empty()) {
+        HeadETags((OssSite *)lsite.get(), ldir, lneeds, l);
+    }
+    if (rsite->type() == STOss && !rneeds.empty()) {
+        HeadETags((OssSite *)rsite.get(), rdir, rneeds, r);
+    }
+    for (auto &[side, i, future] : hashing) {
+        const std::string &etag = future.get();
+        if (!etag.empty()) {
+            side->etags[i] = etag;
+        }
+    }
+    for (const auto &[li, ri] : sameSize) {
+        if (ETagOf(ldir, l, li) == ETagOf(rdir, r, ri)) {
+            l.cmps[li] = r.cmps[ri] = CSEqual;
+        } else {
+            CompareByTime(*ldir->files[li],
+                          *rdir->files[ri],
+                          l.cmps[li],
+                          r.cmps[ri]);
+            rc = 1;
+        }
+    }
+
+    return rc;
+}
+} // namespace
 
 void CompareDirectory(const SitePtr &lsite,
                       const SitePtr &rsite,
@@ -14,6 +315,11 @@ void CompareDirectory(const SitePtr &lsite,
     const DirPtr &ldir = lsite->GetCurrentDir();
     const DirPtr &rdir = rsite->GetCurrentDir();
 
+    // Compared once listed, as the files still grow.
+    if (ldir->listing || rdir->listing) {
+        return;
+    }
+
     if (ldir->comparePath == rdir->path && rdir->comparePath == ldir->path) {
         if (!ldir->compareEnable) {
             ldir->compareEnable = true;
@@ -35,36 +341,107 @@ void CompareDirectory(const SitePtr &lsite,
     ldir->compareEnable = rdir->compareEnable = true;
     ldir->compareRunning = rdir->compareRunning = true;
 
-    DirPtr ldirCopy = ldir->CopyBasic();
-    DirPtr rdirCopy = rdir->CopyBasic();
+    auto next = std::make_shared<Comparison>();
+    next->lsite = lsite->name();
+    next->lpath = ldir->path;
+    next->rsite = rsite->name();
+    next->rpath = rdir->path;
+    next->checkContent = checkContent;
+    Comparison prev = TakeComparison(*next);
+
+    next->ldir = ldir;
+    next->rdir = rdir;
+    next->lorder = SortedByName(ldir->files);
+    next->rorder = SortedByName(rdir->files);
+    next->l.cmps.assign(ldir->files.size(), CSNone);
+    next->r.cmps.assign(rdir->files.size(), CSNone);
+
+    /*
+     * A name listed on both sides as it was last compared keeps its result,
+     * the others are compared in background. A file listed as before keeps
+     * the ETag fetched for it either way.
+     */
+    IndexPairs pairs;
+    size_t lk = 0;
+    size_t rk = 0;
+    auto keepETag = [](CompareSide &from,
+                       size_t i,
+                       CompareSide &to,
+                       size_t j) {
+        auto it = from.etags.find(i);
+        if (it != from.etags.end()) {
+            to.etags[j] = std::move(it->second);
+        }
+    };
+    MergeByName(
+            ldir->files,
+            next->lorder,
+            rdir->files,
+            next->rorder,
+            [&](size_t li, size_t ri) {
+                const std::string &name =
+                        (li != kNoFile ? ldir->files[li] : rdir->files[ri])
+                                ->name;
+                size_t lprev = Seek(prev.ldir, prev.lorder, lk, name);
+                size_t rprev = Seek(prev.rdir, prev.rorder, rk, name);
+                bool lsame = Unchanged(ldir, li, prev.ldir, lprev);
+                bool rsame = Unchanged(rdir, ri, prev.rdir, rprev);
+                if (lsame && li != kNoFile) {
+                    keepETag(prev.l, lprev, next->l, li);
+                }
+                if (rsame && ri != kNoFile) {
+                    keepETag(prev.r, rprev, next->r, ri);
+                }
+                if (!lsame || !rsame) {
+                    pairs.emplace_back(li, ri);
+                    return;
+                }
+                if (li != kNoFile) {
+                    next->l.cmps[li] = prev.l.cmps[lprev];
+                }
+                if (ri != kNoFile) {
+                    next->r.cmps[ri] = prev.r.cmps[rprev];
+                }
+            });
+
+    if (pairs.empty()) {
+        ldir->cmps = next->l.cmps;
+        rdir->cmps = next->r.cmps;
+        ldir->compareRunning = rdir->compareRunning = false;
+        RememberComparison(std::move(*next));
+        lsite->NotifyChanged();
+        rsite->NotifyChanged();
+        return;
+    }
 
     globalExecutor()->submit(
-            [lsite, ldir, ldirCopy, rsite, rdir, rdirCopy, checkContent]() {
-                int rc = CompareDirectory(
-                        lsite, ldirCopy, rsite, rdirCopy, checkContent);
-                wxTheApp->CallAfter(
-                        [lsite, ldir, ldirCopy, rsite, rdir, rdirCopy]() {
-                            if (ldir->comparePath == rdirCopy->path &&
-                                rdir->comparePath == ldirCopy->path) {
-                                for (size_t i = 0; i < ldir->files.size();
-                                     i++) {
-                                    ldir->files[i]->cmp =
-                                            ldirCopy->files[i]->cmp;
-                                }
-                                for (size_t i = 0; i < rdir->files.size();
-                                     i++) {
-                                    rdir->files[i]->cmp =
-                                            rdirCopy->files[i]->cmp;
-                                }
-                                ldir->compareRunning = false;
-                                rdir->compareRunning = false;
-                            }
-                            if (lsite->GetCurrentDir() == ldir &&
-                                rsite->GetCurrentDir() == rdir) {
-                                lsite->NotifyChanged();
-                                rsite->NotifyChanged();
-                            }
-                        });
+            Executor::kBackground,
+            [lsite, rsite, next, pairs = std::move(pairs)]() {
+                ComparePairs(lsite,
+                             next->ldir,
+                             next->l,
+                             rsite,
+                             next->rdir,
+                             next->r,
+                             pairs,
+                             next->checkContent);
+                wxTheApp->CallAfter([lsite, rsite, next]() {
+                    DirPtr ldir = next->ldir;
+                    DirPtr rdir = next->rdir;
+                    if (ldir->comparePath == rdir->path &&
+                        rdir->comparePath == ldir->path) {
+                        ldir->cmps = next->l.cmps;
+                        rdir->cmps = next->r.cmps;
+                        ldir->compareRunning = false;
+                        rdir->compareRunning = false;
+                    }
+                    RememberComparison(std::move(*next));
+                    if (lsite->GetCurrentDir() == ldir &&
+                        rsite->GetCurrentDir() == rdir) {
+                        lsite->NotifyChanged();
+                        rsite->NotifyChanged();
+                    }
+                });
             });
 }
 
@@ -72,78 +449,26 @@ int CompareDirectory(const SitePtr &lsite,
                      const DirPtr &ldir,
                      const SitePtr &rsite,
                      const DirPtr &rdir,
+                     std::vector<CmpResult> &lcmps,
+                     std::vector<CmpResult> &rcmps,
                      bool checkContent) {
     assert(ldir->path.front() == '/');
-    int rc = 0;
-
-    std::map<std::string, const FilePtr &> lfiles;
-    for (const auto &file : ldir->files) {
-        if (file->name == "..") {
-            file->cmp = CSNone;
-            continue;
-        }
-        lfiles.emplace(file->name, file);
-    }
-    std::map<std::string, const FilePtr &> rfiles;
-    for (auto &file : rdir->files) {
-        if (file->name == "..") {
-            file->cmp = CSNone;
-            continue;
-        }
-        rfiles.emplace(file->name, file);
-    }
 
-    for (auto &[name, lfile] : lfiles) {
-        auto it = rfiles.find(name);
-        if (it == rfiles.end()) {
-            lfile->cmp = CSNew;
-            rc = 1;
-        } else {
-            auto &rfile = it->second;
-            if (lfile->type != rfile->type) {
-                lfile->cmp = rfile->cmp = CSConflict;
-                rc = 1;
-            } else {
-                if (lfile->type == FTDirectory) {
-                    // 文件夹结果为None，但需要进一步比较，所以rc=1
-                    lfile->cmp = rfile->cmp = CSNone;
-                    rc = 1;
-                } else if (checkContent) {
-                    bool equal = lfile->stat.size == rfile->stat.size;
-                    if (equal) {
-                        if (lfile->stat.etag.empty()) {
-                            std::string path = ldir->path + lfile->name;
-                            lfile->stat.etag = lsite->GetETag(path);
-                        }
-                        if (rfile->stat.etag.empty()) {
-                            std::string path = rdir->path + rfile->name;
-                            rfile->stat.etag = rsite->GetETag(path);
-                        }
-                        equal = lfile->stat.etag == rfile->stat.etag;
-                    }
-                    if (equal) {
-                        lfile->cmp = rfile->cmp = CSEqual;
-                    } else if (lfile->stat.lastModifiedTime <
-                               rfile->stat.lastModifiedTime) {
-                        lfile->cmp = CSOutdated;
-                        rfile->cmp = CSUpdated;
-                        rc = 1;
-                    } else {
-                        lfile->cmp = CSUpdated;
-                        rfile->cmp = CSOutdated;
-                        rc = 1;
-                    }
-                }
-            }
-        }
-    }
-
-    for (auto &[name, file] : rfiles) {
-        if (lfiles.count(name) == 0) {
-            file->cmp = CSNew;
-            rc = 1;
-        }
-    }
+    CompareSide l;
+    CompareSide r;
+    l.cmps.assign(ldir->files.size(), CSNone);
+    r.cmps.assign(rdir->files.size(), CSNone);
+    IndexPairs pairs;
+    MergeByName(ldir->files,
+                SortedByName(ldir->files),
+                rdir->files,
+                SortedByName(rdir->files),
+                [&pairs](size_t li, size_t ri) {
+                    pairs.emplace_back(li, ri);
+                });
+    int rc = ComparePairs(lsite, ldir, l, rsite, rdir, r, pairs, checkContent);
 
+    lcmps = std::move(l.cmps);
+    rcmps = std::move(r.cmps);
     return rc;
 }
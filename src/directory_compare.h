@@ -2,12 +2,18 @@
 
 #include "site.h"
 
+#include <vector>
+
 void CompareDirectory(const SitePtr &lsite,
                       const SitePtr &rsite,
                       bool checkContent = true);
 
+// Compare ldir with rdir, reading them only, the result of ldir->files[i]
+// to lcmps[i] and of rdir alike. Non-zero unless all equal.
 int CompareDirectory(const SitePtr &lsite,
                      const DirPtr &ldir,
                      const SitePtr &rsite,
                      const DirPtr &rdir,
+                     std::vector<CmpResult> &lcmps,
+                     std::vector<CmpResult> &rcmps,
                      bool checkContent = true);
@@ -0,0 +1,28 @@
+#include "directory_merge.h"
+
+#include <algorithm>
+
+std::vector<size_t> SortedByName(const std::vector<FilePtr> &files) {
+    std::vector<size_t> sorted;
+    sorted.reserve(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i]->name != "..") {
+            sorted.push_back(i);
+        }
+    }
+
+    auto byName = [&files](size_t l, size_t r) {
+        return files[l]->name < files[r]->name;
+    };
+    auto mid = std::is_sorted_until(sorted.begin(), sorted.end(), byName);
+    if (mid == sorted.end()) {
+        return sorted;
+    }
+    // Usually the first entry out of order starts the files, which are
+    // sorted already.
+    if (!std::is_sorted(mid, sorted.end(), byName)) {
+        std::stable_sort(mid, sorted.end(), byName);
+    }
+    std::inplace_merge(sorted.begin(), mid, sorted.end(), byName);
+    return sorted;
+}
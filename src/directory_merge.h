@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "site.h"
+
+// The index of the side not listing a name.
+constexpr size_t kNoFile = static_cast<size_t>(-1);
+
+/**
+ * Indexes of the entries of files but "..", ordered by name. Listings come
+ * with the directories first, each part sorted on its own, so the two parts
+ * are merged in one pass. Parts which are not sorted, like prefixes OSS
+ * sorted with their trailing slash, are sorted first. Of entries sharing a
+ * name the one listed first comes first.
+ */
+std::vector<size_t> SortedByName(const std::vector<FilePtr> &files);
+
+/**
+ * Walk lfiles and rfiles once in the orders l and r SortedByName gives, and
+ * call match(li, ri) with the indexes of the entries of every name, kNoFile
+ * for the side not having it. Of entries sharing a name on one side, only
+ * the first is matched.
+ */
+template <typename Match>
+void MergeByName(const std::vector<FilePtr> &lfiles,
+                 const std::vector<size_t> &l,
+                 const std::vector<FilePtr> &rfiles,
+                 const std::vector<size_t> &r,
+                 Match match) {
+    size_t i = 0;
+    size_t j = 0;
+    // Skip the entries after the first of a name.
+    auto next = [](const std::vector<FilePtr> &files,
+                   const std::vector<size_t> &order,
+                   size_t k) {
+        std::string_view name = files[order[k]]->name;
+        while (++k < order.size() && files[order[k]]->name == name) {
+        }
+        return k;
+    };
+    while (i < l.size() || j < r.size()) {
+        int cmp;
+        if (i == l.size()) {
+            cmp = 1;
+        } else if (j == r.size()) {
+            cmp = -1;
+        } else {
+            cmp = lfiles[l[i]]->name.compare(rfiles[r[j]]->name);
+        }
+        if (cmp < 0) {
+            match(l[i], kNoFile);
+            i = next(lfiles, l, i);
+        } else if (cmp > 0) {
+            match(kNoFile, r[j]);
+            j = next(rfiles, r, j);
+        } else {
+            match(l[i], r[j]);
+            i = next(lfiles, l, i);
+            j = next(rfiles, r, j);
+        }
+    }
+}
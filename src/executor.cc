@@ -1,5 +1,78 @@
 #include "executor.h"
-namespace {} // namespace
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+
+namespace {
+// The WorkStealingExecutor and worker index the current thread belongs to.
+thread_local const Executor *currentExecutor = nullptr;
+thread_local size_t currentWorker = 0;
+
+std::mutex executorsMtx;
+std::vector<const Executor *> executors;
+} // namespace
+
+Executor::Executor() {
+    // Create the timer wheel first, so it outlives static executors.
+    timerWheel();
+    std::lock_guard<std::mutex> lck(executorsMtx);
+    executors.push_back(this);
+}
+
+Executor::~Executor() {
+    std::lock_guard<std::mutex> lck(executorsMtx);
+    executors.erase(std::remove(executors.begin(), executors.end(), this),
+                    executors.end());
+}
+
+void Executor::ForEach(const std::function<void(const Executor &)> &visitor) {
+    std::lock_guard<std::mutex> lck(executorsMtx);
+    for (const auto *executor : executors) {
+        visitor(*executor);
+    }
+}
+
+Executor::TimerId Executor::AddTimer(TaskQueue::Clock::time_point when,
+                                     Priority priority,
+                                     Task task) {
+    // Checked under mtx_, so a stop either sees the timer in DropTimers or
+    // comes first.
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (status_ != kRunning) {
+        return 0;
+    }
+    return timerWheel()->Add(
+            when,
+            [this, priority, task = std::move(task)]() mutable {
+                Enqueue(std::move(task), priority);
+            },
+            this);
+}
+
+void Executor::DropTimers() {
+    timerWheel()->CancelOwner(this);
+}
+
+std::string Executor::DumpStats() {
+    std::ostringstream os;
+    ForEach([&os](const Executor &executor) {
+        const ExecutorStats &stats = executor.stats();
+        std::string name = executor.name();
+        os << (name.empty() ? "(unnamed)" : name) << "\n";
+        os << "  threads: " << stats.threads() << " (active "
+           << stats.active() << ", idle " << stats.idle() << "), started "
+           << stats.threadsStarted << ", exited " << stats.threadsExited
+           << "\n";
+        os << "  tasks: submitted " << stats.submitted << ", completed "
+           << stats.completed() << ", dropped " << stats.dropped
+           << ", queued " << stats.queued() << ", queued high water "
+           << stats.queuedHighWater << "\n";
+        os << "  wait: " << stats.wait.Summary() << "\n";
+        os << "  run: " << stats.run.Summary() << "\n";
+    });
+    return os.str();
+}
 
 SingleThreadExecutor::SingleThreadExecutor() : th_([this]() { Run(); }) {
 }
@@ -10,36 +83,25 @@ SingleThreadExecutor::~SingleThreadExecutor() {
 }
 
 void SingleThreadExecutor::Run() {
+    stats_.threadsStarted++;
     for (;;) {
         std::unique_lock<std::mutex> lck(mtx_);
-        waiting_ = true;
         tasks_cv_.wait(lck, [this]() {
             return !tasks_.empty() || status_ != kRunning;
         });
-        waiting_ = false;
-        no_waiting_cv_.notify_one();
         if (status_ == kTerminate || status_ == kCancelled) {
             break;
         }
         if (!tasks_.empty()) {
-            auto task = std::move(tasks_.front());
-            tasks_.pop();
+            TaskQueue::Clock::time_point enqueued;
+            auto task = TakeTask(enqueued);
             lck.unlock();
-            task();
+            RunTask(task, enqueued);
         } else if (status_ == kShutdown) {
             break;
         }
     }
-}
-
-void SingleThreadExecutor::cancel() {
-    std::unique_lock<std::mutex> lck(mtx_);
-    if (status_ != kCancelled) {
-        status_ = kCancelled;
-        tasks_cv_.notify_one();
-        no_waiting_cv_.wait(lck, [this]() { return !waiting_; });
-        pthread_cancel(th_.native_handle());
-    }
+    stats_.threadsExited++;
 }
 
 FixedThreadPoolExecutor::FixedThreadPoolExecutor(size_t numThreads) {
@@ -56,40 +118,25 @@ FixedThreadPoolExecutor::~FixedThreadPoolExecutor() {
 }
 
 void FixedThreadPoolExecutor::Run() {
+    stats_.threadsStarted++;
     for (;;) {
         std::unique_lock<std::mutex> lck(mtx_);
-        waiting_++;
         tasks_cv_.wait(lck, [this]() {
             return !tasks_.empty() || status_ != kRunning;
         });
-        waiting_--;
-        if (waiting_ == 0) {
-            no_waiting_cv_.notify_one();
-        }
         if (status_ == kTerminate || status_ == kCancelled) {
             break;
         }
         if (!tasks_.empty()) {
-            auto task = std::move(tasks_.front());
-            tasks_.pop();
+            TaskQueue::Clock::time_point enqueued;
+            auto task = TakeTask(enqueued);
             lck.unlock();
-            task();
+            RunTask(task, enqueued);
         } else if (status_ == kShutdown) {
             break;
         }
     }
-}
-
-void FixedThreadPoolExecutor::cancel() {
-    std::unique_lock<std::mutex> lck(mtx_);
-    if (status_ != kCancelled) {
-        status_ = kCancelled;
-        tasks_cv_.notify_all();
-        no_waiting_cv_.wait(lck, [this]() { return waiting_ == 0; });
-        for (auto &th : workers_) {
-            pthread_cancel(th.native_handle());
-        }
-    }
+    stats_.threadsExited++;
 }
 
 ScheduledThreadPoolExecutor::ScheduledThreadPoolExecutor(
@@ -126,25 +173,21 @@ void ScheduledThreadPoolExecutor::Start(Thread *th) {
 void ScheduledThreadPoolExecutor::Run(Thread *th) {
     std::unique_lock<std::mutex> lck(mtx_, std::defer_lock);
     th->status = kThreadRunning;
+    stats_.threadsStarted++;
 
     for (;;) {
         lck.lock();
-        waiting_++;
         tasks_cv_.wait_for(lck, idle_time_, [this]() {
             return !tasks_.empty() || status_ != kRunning;
         });
-        waiting_--;
-        if (waiting_ == 0) {
-            no_waiting_cv_.notify_one();
-        }
         if (status_ == kTerminate || status_ == kCancelled) {
             break;
         }
         if (!tasks_.empty()) {
-            auto task = std::move(tasks_.front());
-            tasks_.pop();
+            TaskQueue::Clock::time_point enqueued;
+            auto task = TakeTask(enqueued);
             lck.unlock();
-            task();
+            RunTask(task, enqueued);
         } else if (status_ == kShutdown || running_ > reserve_threads_) {
             break;
         } else {
@@ -156,9 +199,10 @@ void ScheduledThreadPoolExecutor::Run(Thread *th) {
     th->status = kThreadExiting;
     running_--;
     exiting_++;
+    stats_.threadsExited++;
 }
 
-void ScheduledThreadPoolExecutor::Schedule() {
+void ScheduledThreadPoolExecutor::Schedule(size_t added) {
     std::this_thread::yield();
     std::lock_guard<std::mutex> lck(mtx_);
 
@@ -175,30 +219,243 @@ void ScheduledThreadPoolExecutor::Schedule() {
         }
     }
 
-    if (!tasks_.empty() && running_ < max_threads_) {
-        for (size_t i = 0; i < max_threads_; i++) {
-            if (i == workers_.size()) {
-                workers_.push_back(new Thread);
-            }
-            Thread *th = workers_[i];
-            if (th->status == kThreadEmpty) {
-                Start(th);
-                return;
+    if (tasks_.empty()) {
+        return;
+    }
+    size_t started = 0;
+    for (size_t i = 0; i < max_threads_ && started < added &&
+                       running_ < max_threads_;
+         i++) {
+        if (i == workers_.size()) {
+            workers_.push_back(new Thread);
+        }
+        Thread *th = workers_[i];
+        if (th->status == kThreadEmpty) {
+            Start(th);
+            started++;
+        }
+    }
+}
+
+WorkStealingExecutor::WorkStealingExecutor(size_t numThreads)
+    : concurrency_(std::max<size_t>(numThreads, 1)) {
+    numThreads = std::max<size_t>(numThreads, 1);
+    for (size_t i = 0; i < numThreads; i++) {
+        workers_.emplace_back(new Worker);
+    }
+    for (size_t i = 0; i < numThreads; i++) {
+        workers_[i]->th = std::thread([this, i]() { Run(i); });
+    }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+    shutdown();
+    for (auto &worker : workers_) {
+        if (worker->th.joinable()) {
+            worker->th.join();
+        }
+    }
+}
+
+void WorkStealingExecutor::shutdown() {
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (status_ == kRunning) {
+            status_ = state_ = kShutdown;
+            tasks_cv_.notify_all();
+            throttle_cv_.notify_all();
+            space_cv_.notify_all();
+        }
+    }
+    DropTimers();
+}
+
+void WorkStealingExecutor::terminate() {
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (status_ < kTerminate) {
+            status_ = state_ = kTerminate;
+            tasks_cv_.notify_all();
+            throttle_cv_.notify_all();
+            space_cv_.notify_all();
+        }
+    }
+    DropTimers();
+}
+
+void WorkStealingExecutor::cancel() {
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (status_ != kCancelled) {
+            status_ = state_ = kCancelled;
+            for (auto &worker : workers_) {
+                std::lock_guard<std::mutex> workerLck(worker->mtx);
+                pending_ -= worker->tasks.size();
+                stats_.dropped += worker->tasks.size();
+                worker->tasks.clear();
             }
+            tasks_cv_.notify_all();
+            throttle_cv_.notify_all();
+            space_cv_.notify_all();
         }
     }
+    DropTimers();
 }
 
-void ScheduledThreadPoolExecutor::cancel() {
-    std::unique_lock<std::mutex> lck(mtx_);
-    if (status_ != kCancelled) {
-        status_ = kCancelled;
-        tasks_cv_.notify_all();
-        no_waiting_cv_.wait(lck, [this]() { return waiting_ == 0; });
-        for (auto *th : workers_) {
-            if (th->status == kThreadRunning) {
-                pthread_cancel(th->th.native_handle());
+void WorkStealingExecutor::set_concurrency(size_t n) {
+    n = std::min(std::max<size_t>(n, 1), workers_.size());
+    std::lock_guard<std::mutex> lck(mtx_);
+    concurrency_ = n;
+    throttle_cv_.notify_all();
+}
+
+void WorkStealingExecutor::Enqueue(Task task, Priority) {
+    size_t index;
+    if (currentExecutor == this) {
+        index = currentWorker;
+    } else {
+        index = next_.fetch_add(1, std::memory_order_relaxed) %
+                workers_.size();
+    }
+    Worker &worker = *workers_[index];
+    {
+        std::lock_guard<std::mutex> lck(worker.mtx);
+        worker.tasks.push_back({std::move(task), TaskQueue::Clock::now()});
+        stats_.Enqueued(++pending_);
+    }
+    // A worker increments parked_ before it checks pending_, and we read
+    // parked_ after incrementing pending_, so one of us sees the other.
+    if (parked_ > 0) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        tasks_cv_.notify_one();
+    }
+}
+
+size_t WorkStealingExecutor::EnqueueBulk(Task *tasks,
+                                         size_t n,
+                                         Priority) {
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        n = std::min(n, WaitForRoom(lck));
+    }
+    if (n == 0) {
+        return 0;
+    }
+    auto now = TaskQueue::Clock::now();
+    if (currentExecutor == this) {
+        // Keep them local like Enqueue, idle workers steal them.
+        Worker &worker = *workers_[currentWorker];
+        std::lock_guard<std::mutex> lck(worker.mtx);
+        for (size_t i = 0; i < n; i++) {
+            worker.tasks.push_back({std::move(tasks[i]), now});
+        }
+        stats_.Enqueued(pending_ += n, n);
+    } else {
+        // One contiguous share per deque, each locked once.
+        size_t count = workers_.size();
+        size_t first = next_.fetch_add(count, std::memory_order_relaxed);
+        size_t share = (n + count - 1) / count;
+        for (size_t w = 0, i = 0; w < count && i < n; w++) {
+            Worker &worker = *workers_[(first + w) % count];
+            std::lock_guard<std::mutex> lck(worker.mtx);
+            size_t end = std::min(i + share, n);
+            size_t added = end - i;
+            for (; i < end; i++) {
+                worker.tasks.push_back({std::move(tasks[i]), now});
             }
+            stats_.Enqueued(pending_ += added, added);
+        }
+    }
+    if (parked_ > 0) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        tasks_cv_.notify_all();
+    }
+    return n;
+}
+
+bool WorkStealingExecutor::Pop(size_t index,
+                               Task &task,
+                               TaskQueue::Clock::time_point &enqueued) {
+    {
+        Worker &worker = *workers_[index];
+        std::lock_guard<std::mutex> lck(worker.mtx);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.back().task);
+            enqueued = worker.tasks.back().time;
+            worker.tasks.pop_back();
+            pending_--;
+            return true;
+        }
+    }
+
+    thread_local std::minstd_rand rand(std::random_device{}());
+    size_t n = workers_.size();
+    size_t start = rand() % n;
+    for (size_t i = 0; i < n; i++) {
+        size_t victim = (start + i) % n;
+        if (victim == index) {
+            continue;
+        }
+        Worker &worker = *workers_[victim];
+        std::lock_guard<std::mutex> lck(worker.mtx);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.front().task);
+            enqueued = worker.tasks.front().time;
+            worker.tasks.pop_front();
+            pending_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingExecutor::NotifySpace() {
+    // Producers increment producers_ before checking pending_ under mtx_.
+    if (producers_ > 0) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        space_cv_.notify_one();
+    }
+}
+
+void WorkStealingExecutor::Run(size_t index) {
+    currentExecutor = this;
+    currentWorker = index;
+    stats_.threadsStarted++;
+
+    for (;;) {
+        Status state = state_;
+        if (state == kTerminate || state == kCancelled) {
+            break;
+        }
+        if (index >= concurrency_) {
+            // Once stopping, every worker helps draining.
+            std::unique_lock<std::mutex> lck(mtx_);
+            throttle_cv_.wait(lck, [this, index]() {
+                return index < concurrency_ || status_ != kRunning;
+            });
+        }
+        Task task;
+        TaskQueue::Clock::time_point enqueued;
+        if (Pop(index, task, enqueued)) {
+            NotifySpace();
+            RunTask(task, enqueued);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (status_ != kRunning && (status_ != kShutdown || pending_ == 0)) {
+            break;
+        }
+        parked_++;
+        tasks_cv_.wait(lck, [this]() {
+            return pending_ > 0 || status_ != kRunning;
+        });
+        parked_--;
+        // Throttled while parked, the wakeup of Enqueue is passed on to a
+        // worker that may run the task instead of lost on throttle_cv_.
+        if (index >= concurrency_ && pending_ > 0 && parked_ > 0) {
+            tasks_cv_.notify_one();
         }
     }
+    stats_.threadsExited++;
 }
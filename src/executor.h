@@ -1,62 +1,412 @@
 #pragma once
 
-#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
 #include <thread>
 #include <vector>
 
+#include "executor_stats.h"
+#include "timer_wheel.h"
+#include "unique_task.h"
+
 #include <ctime>
 #include <iomanip>
 #include <sstream>
 
+/**
+ * Tasks waiting in an executor, in one FIFO lane per priority. A task ages
+ * one priority level every aging interval it waits, so a queued task is
+ * eventually taken even while higher lanes are never empty.
+ */
+class TaskQueue {
+public:
+    enum Priority { kInteractive, kBackground, kBulk, kPriorityCount };
+    using Task = UniqueTask;
+    using Clock = std::chrono::steady_clock;
+
+    TaskQueue(Clock::duration aging = std::chrono::milliseconds(500))
+        : aging_(aging) {}
+
+    void push(Task task, Priority priority) {
+        lanes_[priority].push_back({std::move(task), Clock::now()});
+        size_++;
+    }
+
+    bool empty() const { return size_ == 0; }
+
+    size_t size() const { return size_; }
+
+    void clear() {
+        for (auto &lane : lanes_) {
+            lane.clear();
+        }
+        size_ = 0;
+    }
+
+    // Take the task with the best aged priority, ties go to the higher lane.
+    // Require !empty(). The time it was pushed is stored to enqueued.
+    Task take(Clock::time_point &enqueued) {
+        Clock::time_point now = Clock::now();
+        int best = -1;
+        Clock::duration bestRank{};
+        for (int i = 0; i < kPriorityCount; i++) {
+            if (lanes_[i].empty()) {
+                continue;
+            }
+            Clock::duration rank = aging_ * i - (now - lanes_[i].front().time);
+            if (best < 0 || rank < bestRank) {
+                best = i;
+                bestRank = rank;
+            }
+        }
+        Task task = std::move(lanes_[best].front().task);
+        enqueued = lanes_[best].front().time;
+        lanes_[best].pop_front();
+        size_--;
+        return task;
+    }
+
+private:
+    struct Item {
+        Task task;
+        Clock::time_point time;
+    };
+
+    const Clock::duration aging_;
+    std::deque<Item> lanes_[kPriorityCount];
+    size_t size_{0};
+};
+
 class Executor {
 public:
     enum Status { kRunning, kShutdown, kTerminate, kCancelled };
-    using Task = std::function<void()>;
+    using Priority = TaskQueue::Priority;
+    // Navigation and other requests a user is waiting for.
+    static constexpr Priority kInteractive = TaskQueue::kInteractive;
+    // Work started by the application, like comparing directories.
+    static constexpr Priority kBackground = TaskQueue::kBackground;
+    // Large batches, like submitting the tasks of a sync.
+    static constexpr Priority kBulk = TaskQueue::kBulk;
+    using Task = TaskQueue::Task;
+    using TimerId = TimerWheel::TimerId;
+
+    Executor();
+    virtual ~Executor();
+
+    template <typename F,
+              typename... Args,
+              typename = std::enable_if_t<
+                      !std::is_same_v<std::decay_t<F>, Priority>>>
+    void submit(F &&f, Args &&...args) {
+        submit(kBackground, std::forward<F>(f), std::forward<Args>(args)...);
+    }
 
-    Executor() = default;
-    virtual ~Executor() = default;
+    template <typename F, typename... Args>
+    void submit(Priority priority, F &&f, Args &&...args) {
+        Enqueue(MakeTask(std::forward<F>(f), std::forward<Args>(args)...),
+                priority);
+    }
 
-    template <typename F, typename... Args> void submit(F &&f, Args &&...args) {
-        std::unique_lock<std::mutex> lck(mtx_);
-        tasks_.push([f, args...]() { f(args...); });
-        lck.unlock();
-        tasks_cv_.notify_one();
-        Schedule();
+    /**
+     * Producer side of the capacity: wait while capacity() tasks are queued,
+     * then submit. Returns false without submitting if the executor stopped
+     * meanwhile. Never call it from a worker of the same executor.
+     */
+    template <typename F, typename... Args>
+    bool submit_wait(Priority priority, F &&f, Args &&...args) {
+        if (!AcquireSlot(true)) {
+            return false;
+        }
+        Enqueue(MakeTask(std::forward<F>(f), std::forward<Args>(args)...),
+                priority);
+        return true;
+    }
+
+    // Submit only if less than capacity() tasks are queued.
+    template <typename F, typename... Args>
+    bool try_submit(Priority priority, F &&f, Args &&...args) {
+        if (!AcquireSlot(false)) {
+            return false;
+        }
+        Enqueue(MakeTask(std::forward<F>(f), std::forward<Args>(args)...),
+                priority);
+        return true;
+    }
+
+    /**
+     * Submit fn(item) for every item of [begin, end), taking the lock once
+     * per batch rather than once per task. With a capacity set it waits for
+     * space like submit_wait, and every batch fills the free slots. Returns
+     * how many were submitted, the first ones, fewer if the executor stopped
+     * before all were.
+     */
+    template <typename It, typename F>
+    size_t submit_range(Priority priority, It begin, It end, const F &fn) {
+        std::vector<Task> tasks;
+        if constexpr (std::is_base_of_v<
+                              std::forward_iterator_tag,
+                              typename std::iterator_traits<
+                                      It>::iterator_category>) {
+            tasks.reserve(std::distance(begin, end));
+        }
+        for (; begin != end; ++begin) {
+            tasks.push_back(MakeTask(fn, *begin));
+        }
+        size_t done = 0;
+        while (done < tasks.size()) {
+            size_t n = EnqueueBulk(
+                    tasks.data() + done, tasks.size() - done, priority);
+            if (!n) {
+                break;
+            }
+            done += n;
+        }
+        return done;
+    }
+
+    /**
+     * Submit the task once delay passed. Until then it waits in the timer
+     * wheel rather than the queue, and it is dropped if the executor stops
+     * first. Returns the timer for cancel_timer, zero if already stopped.
+     */
+    template <typename F, typename... Args>
+    TimerId submit_after(TaskQueue::Clock::duration delay,
+                         Priority priority,
+                         F &&f,
+                         Args &&...args) {
+        return AddTimer(
+                TaskQueue::Clock::now() + delay,
+                priority,
+                MakeTask(std::forward<F>(f), std::forward<Args>(args)...));
+    }
+
+    // Like submit_after, at a point in time.
+    template <typename F, typename... Args>
+    TimerId submit_at(TaskQueue::Clock::time_point when,
+                      Priority priority,
+                      F &&f,
+                      Args &&...args) {
+        return AddTimer(
+                when,
+                priority,
+                MakeTask(std::forward<F>(f), std::forward<Args>(args)...));
+    }
+
+    // Drop a delayed task that was not submitted yet, return whether it was.
+    bool cancel_timer(TimerId timer) { return timerWheel()->Cancel(timer); }
+
+    /**
+     * Bound the number of queued tasks for submit_wait and try_submit, zero
+     * means unbounded. submit itself never blocks, so the capacity can be
+     * exceeded by it.
+     */
+    void set_capacity(size_t capacity) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        capacity_ = capacity;
+        space_cv_.notify_all();
+    }
+
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return capacity_;
     }
 
     // No more tasks, but the current task in queue will be executed.
     virtual void shutdown() {
-        std::lock_guard<std::mutex> lck(mtx_);
-        if (status_ == kRunning) {
-            status_ = kShutdown;
-            tasks_cv_.notify_all();
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            if (status_ == kRunning) {
+                status_ = kShutdown;
+                tasks_cv_.notify_all();
+                space_cv_.notify_all();
+            }
         }
+        DropTimers();
     }
 
     // The task which was currently running will be finished.
     virtual void terminate() {
-        std::lock_guard<std::mutex> lck(mtx_);
-        if (status_ < kTerminate) {
-            status_ = kTerminate;
-            tasks_cv_.notify_all();
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            if (status_ < kTerminate) {
+                status_ = kTerminate;
+                tasks_cv_.notify_all();
+                space_cv_.notify_all();
+            }
         }
+        DropTimers();
     }
 
-    // Cancel the execution immedially, may downgrade to terminate.
-    virtual void cancel() = 0;
+    /**
+     * Like terminate, and the queued tasks are dropped. Running tasks are not
+     * interrupted, they are expected to watch their CancellationToken and
+     * return early, the destructor joins the workers.
+     */
+    virtual void cancel() {
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            if (status_ != kCancelled) {
+                status_ = kCancelled;
+                stats_.dropped += tasks_.size();
+                tasks_.clear();
+                tasks_cv_.notify_all();
+                space_cv_.notify_all();
+            }
+        }
+        DropTimers();
+    }
 
     Status status() const {
         std::lock_guard<std::mutex> lck(mtx_);
         return status_;
     }
 
+    // Name shown with the statistics.
+    void set_name(const std::string &name) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        name_ = name;
+    }
+
+    std::string name() const {
+        std::lock_guard<std::mutex> lck(mtx_);
+        return name_;
+    }
+
+    const ExecutorStats &stats() const { return stats_; }
+
+    // Visit every living executor, they can not be destroyed meanwhile.
+    static void ForEach(const std::function<void(const Executor &)> &visitor);
+
+    // Statistics of every living executor as text, one block per executor.
+    static std::string DumpStats();
+
 protected:
-    virtual void Schedule() = 0;
+    // The arguments are moved into the task and moved out when it runs once.
+    template <typename F, typename... Args>
+    static Task MakeTask(F &&f, Args &&...args) {
+        if constexpr (sizeof...(Args) == 0) {
+            return Task(std::forward<F>(f));
+        } else {
+            return Task([f = std::forward<F>(f),
+                         ... args = std::forward<Args>(args)]() mutable {
+                std::invoke(std::move(f), std::move(args)...);
+            });
+        }
+    }
+
+    virtual void Enqueue(Task task, Priority priority) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        tasks_.push(std::move(task), priority);
+        stats_.Enqueued(tasks_.size());
+        lck.unlock();
+        tasks_cv_.notify_one();
+        Schedule(1);
+    }
+
+    /**
+     * Enqueue the first of the n tasks, as many as the capacity has room
+     * for, after waiting for room. Returns how many, zero once stopped.
+     */
+    virtual size_t EnqueueBulk(Task *tasks, size_t n, Priority priority) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        n = std::min(n, WaitForRoom(lck));
+        for (size_t i = 0; i < n; i++) {
+            tasks_.push(std::move(tasks[i]), priority);
+        }
+        stats_.Enqueued(tasks_.size(), n);
+        lck.unlock();
+        if (n > 0) {
+            tasks_cv_.notify_all();
+            Schedule(n);
+        }
+        return n;
+    }
+
+    // Put task in the timer wheel, unless the executor stopped.
+    TimerId AddTimer(TaskQueue::Clock::time_point when,
+                     Priority priority,
+                     Task task);
+
+    /**
+     * Drop the delayed tasks once the executor stopped, and wait for one
+     * being submitted meanwhile. Called without mtx_, which the timer thread
+     * takes to submit.
+     */
+    void DropTimers();
+
+    // Number of queued tasks, called with mtx_ held.
+    virtual size_t QueuedLocked() const { return tasks_.size(); }
+
+    // Wait until the capacity leaves room and return the free slots, zero if
+    // stopped. lck holds mtx_.
+    size_t WaitForRoom(std::unique_lock<std::mutex> &lck) {
+        producers_++;
+        space_cv_.wait(lck, [this]() {
+            return status_ != kRunning || !capacity_ ||
+                   QueuedLocked() < capacity_;
+        });
+        producers_--;
+        if (status_ != kRunning) {
+            return 0;
+        }
+        return capacity_ ? capacity_ - QueuedLocked() : SIZE_MAX;
+    }
+
+    bool AcquireSlot(bool block) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        if (block) {
+            producers_++;
+            space_cv_.wait(lck, [this]() {
+                return status_ != kRunning || !capacity_ ||
+                       QueuedLocked() < capacity_;
+            });
+            producers_--;
+        }
+        return status_ == kRunning &&
+               (!capacity_ || QueuedLocked() < capacity_);
+    }
+
+    // Take the next task and wake a waiting producer, called with mtx_ held.
+    Task TakeTask(TaskQueue::Clock::time_point &enqueued) {
+        Task task = tasks_.take(enqueued);
+        if (producers_ > 0) {
+            space_cv_.notify_one();
+        }
+        return task;
+    }
+
+    void RunTask(Task &task, TaskQueue::Clock::time_point enqueued) {
+        auto start = TaskQueue::Clock::now();
+        stats_.wait.Record(start - enqueued);
+        task();
+        stats_.run.Record(TaskQueue::Clock::now() - start);
+    }
+
+    // Start threads for added new tasks, if the executor does so.
+    virtual void Schedule(size_t added) = 0;
 
     Status status_{kRunning};
     mutable std::mutex mtx_;
     std::condition_variable tasks_cv_;
-    std::queue<Task> tasks_;
+    TaskQueue tasks_;
+
+    size_t capacity_{0};
+    // Producers waiting in submit_wait.
+    std::atomic<size_t> producers_{0};
+    std::condition_variable space_cv_;
+
+    std::string name_;
+    ExecutorStats stats_;
 };
 
 class SingleThreadExecutor : public Executor {
@@ -65,15 +415,11 @@ public:
 
     ~SingleThreadExecutor();
 
-    void cancel() override;
-
 private:
     void Run();
 
-    void Schedule() override {}
+    void Schedule(size_t) override {}
 
-    bool waiting_{false};
-    std::condition_variable no_waiting_cv_;
     std::thread th_;
 };
 
@@ -84,15 +430,11 @@ public:
 
     ~FixedThreadPoolExecutor();
 
-    void cancel() override;
-
 private:
     void Run();
 
-    void Schedule() override {}
+    void Schedule(size_t) override {}
 
-    size_t waiting_{0};
-    std::condition_variable no_waiting_cv_;
     std::vector<std::thread> workers_;
 };
 
@@ -118,22 +460,92 @@ public:
 
     ~ScheduledThreadPoolExecutor();
 
-    void cancel() override;
-
 private:
     void Start(Thread *th);
 
     void Run(Thread *th);
 
-    void Schedule() override;
+    void Schedule(size_t added) override;
 
     const size_t reserve_threads_;
     const size_t max_threads_;
     const std::chrono::milliseconds idle_time_;
 
     size_t running_{0};
-    size_t waiting_{0};
     size_t exiting_{0};
-    std::condition_variable no_waiting_cv_;
     std::vector<Thread *> workers_;
 };
+
+/**
+ * Every worker owns a deque. A worker pushes and pops its own tasks at the
+ * back, tasks submitted from other threads are spread over the deques round
+ * robin, and a worker whose deque is empty steals from the front of the
+ * others, starting at a random one. The executor mutex is only taken to park
+ * and wake idle workers, so busy workers do not serialize on it.
+ * There are no priority lanes, the transfer pools only run bulk work.
+ */
+class WorkStealingExecutor : public Executor {
+public:
+    WorkStealingExecutor(
+            size_t numThreads = std::thread::hardware_concurrency());
+
+    ~WorkStealingExecutor();
+
+    void shutdown() override;
+
+    void terminate() override;
+
+    void cancel() override;
+
+    /**
+     * Let only the first n workers run tasks, the others park until it is
+     * raised again. n is clamped to [1, threads], the queued tasks of parked
+     * workers are stolen by the running ones.
+     */
+    void set_concurrency(size_t n);
+
+    size_t concurrency() const { return concurrency_; }
+
+    size_t max_concurrency() const { return workers_.size(); }
+
+protected:
+    void Enqueue(Task task, Priority priority) override;
+
+    size_t EnqueueBulk(Task *tasks, size_t n, Priority priority) override;
+
+    size_t QueuedLocked() const override { return pending_; }
+
+private:
+    struct Item {
+        Task task;
+        TaskQueue::Clock::time_point time;
+    };
+
+    struct Worker {
+        std::mutex mtx;
+        std::deque<Item> tasks;
+        std::thread th;
+    };
+
+    void Run(size_t index);
+
+    bool Pop(size_t index,
+             Task &task,
+             TaskQueue::Clock::time_point &enqueued);
+
+    void NotifySpace();
+
+    void Schedule(size_t) override {}
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // Mirrors status_ so workers can check it without taking mtx_.
+    std::atomic<Status> state_{kRunning};
+    // Number of tasks in all deques, changed under the deque mutex.
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> parked_{0};
+    std::atomic<size_t> next_{0};
+    std::atomic<size_t> concurrency_;
+    // Workers beyond concurrency_ wait here, apart from tasks_cv_ so that
+    // waking one for a new task never picks a worker that may not run it.
+    std::condition_variable throttle_cv_;
+};
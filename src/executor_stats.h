@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+/**
+ * Histogram of latencies in power of two buckets of microseconds, bucket i
+ * holds the latencies below 2^i us and the last one everything longer.
+ * Recording is lock free and spread over a few shards by thread, so workers
+ * of one executor do not contend on it for every task.
+ */
+class LatencyHistogram {
+public:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int kBuckets = 32;
+    static constexpr int kShards = 8;
+
+    void Record(Clock::duration latency) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency)
+                          .count();
+        uint64_t v = us > 0 ? us : 0;
+        // The bit width of v, the smallest i with v < 2^i.
+        int bucket = v ? 64 - __builtin_clzll(v) : 0;
+        if (bucket > kBuckets - 1) {
+            bucket = kBuckets - 1;
+        }
+        Shard &shard = shards_[ShardIndex()];
+        shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (const auto &shard : shards_) {
+            n += shard.count.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    std::chrono::microseconds mean() const {
+        uint64_t n = 0, sum = 0;
+        for (const auto &shard : shards_) {
+            n += shard.count.load(std::memory_order_relaxed);
+            sum += shard.sum.load(std::memory_order_relaxed);
+        }
+        return std::chrono::microseconds(n ? sum / n : 0);
+    }
+
+    // Upper bound of the bucket holding the p quantile, p in [0, 1].
+    std::chrono::microseconds percentile(double p) const {
+        uint64_t buckets[kBuckets] = {};
+        uint64_t n = 0;
+        for (const auto &shard : shards_) {
+            for (int i = 0; i < kBuckets; i++) {
+                uint64_t c = shard.buckets[i].load(std::memory_order_relaxed);
+                buckets[i] += c;
+                n += c;
+            }
+        }
+        if (!n) {
+            return std::chrono::microseconds(0);
+        }
+        uint64_t rank = uint64_t(p * (n - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::chrono::microseconds(uint64_t(1) << i);
+            }
+        }
+        return std::chrono::microseconds(uint64_t(1) << (kBuckets - 1));
+    }
+
+    // Count, mean and the p50, p90 and p99 bounds in one line.
+    std::string Summary() const {
+        std::ostringstream os;
+        os << "count " << count() << ", mean " << Format(mean()) << ", p50 <"
+           << Format(percentile(0.5)) << ", p90 <" << Format(percentile(0.9))
+           << ", p99 <" << Format(percentile(0.99));
+        return os.str();
+    }
+
+private:
+    static std::string Format(std::chrono::microseconds us) {
+        auto n = us.count();
+        if (n < 1000) {
+            return std::to_string(n) + "us";
+        } else if (n < 1000 * 1000) {
+            return std::to_string(n / 1000) + "ms";
+        }
+        return std::to_string(n / (1000 * 1000)) + "s";
+    }
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> buckets[kBuckets]{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+    };
+
+    static int ShardIndex() {
+        static std::atomic<int> next{0};
+        thread_local int index = next++ % kShards;
+        return index;
+    }
+
+    Shard shards_[kShards];
+};
+
+/**
+ * Counters of an executor, updated by the executor and read by anyone
+ * without locking, so a snapshot may be slightly inconsistent.
+ */
+struct ExecutorStats {
+    // The task counts are derived from these and the histogram counts, to
+    // keep the atomics touched per task few.
+    std::atomic<uint64_t> submitted{0};
+    // Dropped by cancel before they started.
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<size_t> queuedHighWater{0};
+    std::atomic<uint64_t> threadsStarted{0};
+    std::atomic<uint64_t> threadsExited{0};
+    // From submit to the start of the task.
+    LatencyHistogram wait;
+    // Running time of the task.
+    LatencyHistogram run;
+
+    uint64_t completed() const { return run.count(); }
+
+    size_t active() const { return Difference(wait.count(), run.count()); }
+
+    size_t queued() const {
+        return Difference(submitted, wait.count() + dropped);
+    }
+
+    size_t threads() const {
+        return Difference(threadsStarted, threadsExited);
+    }
+
+    size_t idle() const { return Difference(threads(), active()); }
+
+    // n tasks were queued, making depth tasks queued.
+    void Enqueued(size_t depth, size_t n = 1) {
+        submitted.fetch_add(n, std::memory_order_relaxed);
+        size_t high = queuedHighWater.load(std::memory_order_relaxed);
+        while (depth > high &&
+               !queuedHighWater.compare_exchange_weak(
+                       high, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+private:
+    // The counters are read one by one, so clamp a racy negative result.
+    static size_t Difference(uint64_t a, uint64_t b) {
+        return a > b ? a - b : 0;
+    }
+};
@@ -266,6 +266,12 @@ void Explorer::SiteUpdated(Site *site) {
     }
 }
 
+void Explorer::SiteFilesAppended(Site *site) {
+    for (auto *l : listeners_) {
+        l->ExplorerSiteUpdated(this, site);
+    }
+}
+
 void Explorer::SelectionUpdated(FileListCtrl *fileListCtrl) {
     for (auto *l : listeners_) {
         l->ExplorerSelectionUpdated(this, fileListCtrl);
@@ -70,6 +70,7 @@ private:
     void ActivateOssPanel(wxFocusEvent &event);
 
     void SiteUpdated(Site *site) override;
+    void SiteFilesAppended(Site *site) override;
     void SelectionUpdated(FileListCtrl *fileListCtrl) override;
     void QuitDiff();
     bool IsPeerPath() const;
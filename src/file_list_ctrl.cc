@@ -86,6 +86,12 @@ void FileListCtrl::SiteUpdated(Site *site) {
     Update();
 }
 
+// Grow the items, keeping the selection made while the dir is listed.
+void FileListCtrl::SiteFilesAppended(Site *site) {
+    SetItemCount(site_->GetFiles().size());
+    selections_.resize(site_->GetFiles().size());
+}
+
 void FileListCtrl::SetFileColumns() {
     ClearAll();
     const int widths[4] = {272, 88, 96, 122};
@@ -135,11 +141,11 @@ wxListItemAttr *FileListCtrl::OnGetItemAttr(long item) const {
     }
 #endif
     const auto &dir = site_->GetCurrentDir();
-    if (!dir->compareEnable || dir->compareRunning) {
+    if (!dir->compareEnable || dir->compareRunning ||
+        static_cast<size_t>(item) >= dir->cmps.size()) {
         return nullptr;
     }
-    const auto &file = site_->GetFiles()[item];
-    switch (file->cmp) {
+    switch (dir->cmps[item]) {
     case CSEqual:
         return nullptr;
     case CSNew:
@@ -46,6 +46,7 @@ public:
 protected:
     void InitCompareItemColors();
     void SiteUpdated(Site *site) override;
+    void SiteFilesAppended(Site *site) override;
 
     void SetFileColumns();
 
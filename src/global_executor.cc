@@ -1,6 +1,10 @@
 #include "global_executor.h"
 
 Executor *globalExecutor() {
-    static ScheduledThreadPoolExecutor executor;
-    return &executor;
+    static std::unique_ptr<Executor> executor = []() {
+        std::unique_ptr<Executor> executor(new ScheduledThreadPoolExecutor);
+        executor->set_name("global");
+        return executor;
+    }();
+    return executor.get();
 }
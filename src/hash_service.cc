@@ -0,0 +1,151 @@
+#include "hash_service.h"
+#include "local_site.h"
+#include "md5.h"
+#include "storage.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// The cache key of path, false if it can not be stat.
+bool KeyOf(const std::string &path, HashKey &key) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    key.device = st.st_dev;
+    key.inode = st.st_ino;
+    key.size = st.st_size;
+#ifdef __APPLE__
+    const struct timespec &mtime = st.st_mtimespec;
+#else
+    const struct timespec &mtime = st.st_mtim;
+#endif
+    key.mtime = int64_t(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+    return true;
+}
+
+} // namespace
+
+HashService *hashService() {
+    static HashService service;
+    return &service;
+}
+
+HashService::HashService(size_t threads)
+    : pool_(std::max<size_t>(threads, 1)) {
+    pool_.set_name("hash");
+}
+
+// A file this service hashes, with the key it is cached under.
+struct HashService::Pending {
+    std::string path;
+    HashKey key;
+    bool cacheable;
+    std::shared_ptr<std::promise<std::string>> promise;
+};
+
+std::shared_future<std::string> HashService::ContentETag(
+        const std::string &path,
+        Executor::Priority priority) {
+    std::vector<Pending> pending;
+    std::shared_future<std::string> etag = Start(path, pending);
+    if (!pending.empty()) {
+        pool_.submit(priority, [this, file = std::move(pending.front())]() {
+            Finish(file, LocalSite::GetETagStatic(file.path));
+        });
+    }
+    return etag;
+}
+
+std::vector<std::shared_future<std::string>> HashService::ContentETags(
+        const std::vector<std::string> &paths,
+        Executor::Priority priority) {
+    std::vector<std::shared_future<std::string>> etags;
+    std::vector<Pending> pending;
+    for (const auto &path : paths) {
+        etags.push_back(Start(path, pending));
+    }
+    // Enough files per task to keep the lanes full while small files come
+    // and go, and tasks for every thread of the pool once there are many.
+    size_t batch = Md5Lanes() * 8;
+    for (size_t i = 0; i < pending.size(); i += batch) {
+        auto begin = pending.begin() + i;
+        auto end = begin + std::min(batch, pending.size() - i);
+        std::vector<Pending> files(std::make_move_iterator(begin),
+                                   std::make_move_iterator(end));
+        pool_.submit(priority, [this, files = std::move(files)]() {
+            std::vector<std::string> paths;
+            for (const auto &file : files) {
+                paths.push_back(file.path);
+            }
+            std::vector<std::string> hashed = Md5FileETags(paths);
+            for (size_t i = 0; i < files.size(); i++) {
+                Finish(files[i], hashed[i]);
+            }
+        });
+    }
+    return etags;
+}
+
+void HashService::CachePartETag(const std::string &path,
+                                const FileStat &stat,
+                                const std::vector<std::string> &partETags,
+                                const std::string &uploaded) {
+    HashKey key;
+    if (!KeyOf(path, key) || key.size != int64_t(stat.size) ||
+        key.mtime / 1000000000 != stat.lastModifiedTime) {
+        return;
+    }
+    std::string partETag = Md5PartETag(partETags);
+    if (!partETag.empty() && partETag == uploaded) {
+        storage()->StorePartHash(path, key, partETag);
+    }
+}
+
+bool HashService::CachedPartETag(const std::string &path,
+                                 std::string &partETag) {
+    HashKey key;
+    return KeyOf(path, key) && storage()->LookupPartHash(path, key, partETag);
+}
+
+std::shared_future<std::string> HashService::Start(
+        const std::string &path,
+        std::vector<Pending> &pending) {
+    HashKey key;
+    bool cacheable = KeyOf(path, key);
+    std::string cached;
+    if (cacheable && storage()->LookupHash(path, key, cached)) {
+        std::promise<std::string> promise;
+        promise.set_value(cached);
+        return promise.get_future().share();
+    }
+
+    std::lock_guard<std::mutex> lck(mtx_);
+    auto it = hashing_.find(path);
+    if (it != hashing_.end()) {
+        return it->second;
+    }
+    auto promise = std::make_shared<std::promise<std::string>>();
+    std::shared_future<std::string> etag = promise->get_future().share();
+    hashing_.emplace(path, etag);
+    pending.push_back({path, key, cacheable, promise});
+    return etag;
+}
+
+void HashService::Finish(const Pending &file, const std::string &etag) {
+    // Only cached if the file did not change while it was read.
+    HashKey after;
+    if (file.cacheable && !etag.empty() && KeyOf(file.path, after) &&
+        after == file.key) {
+        storage()->StoreHash(file.path, file.key, etag);
+    }
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        hashing_.erase(file.path);
+    }
+    file.promise->set_value(etag);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "executor.h"
+
+struct FileStat;
+
+/**
+ * Hashes local files on a pool of its own, one thread per CPU, so threads
+ * doing requests hand the digest of a large file off instead of running it,
+ * and no more files are hashed at once than there are CPUs.
+ */
+class HashService {
+public:
+    explicit HashService(
+            size_t threads = std::thread::hardware_concurrency());
+
+    /**
+     * Start hashing path to the ETag OSS gives a single part upload of it,
+     * empty if the file can not be read. Callers asking for a file already
+     * being hashed share that result. The ETag is kept in the storage with
+     * the device, inode, size and mtime of the file, and taken from there
+     * while the file still has them instead of reading it again.
+     */
+    std::shared_future<std::string> ContentETag(
+            const std::string &path,
+            Executor::Priority priority = Executor::kBackground);
+
+    /**
+     * ContentETag of each of paths. The files neither cached nor already
+     * being hashed are hashed in batches, each batch in one thread with the
+     * widest MD5 kernel of the CPU, which hashes several files at once.
+     */
+    std::vector<std::shared_future<std::string>> ContentETags(
+            const std::vector<std::string> &paths,
+            Executor::Priority priority = Executor::kBackground);
+
+    /**
+     * Cache uploaded, the ETag OSS gave the multipart upload of path, so the
+     * listing is enough to compare them later. It is made from partETags,
+     * those OSS gave the parts, instead of reading the file again, and only
+     * cached while path still has stat, the one its parts were read with.
+     */
+    void CachePartETag(const std::string &path,
+                       const FileStat &stat,
+                       const std::vector<std::string> &partETags,
+                       const std::string &uploaded);
+
+    // The multipart ETag cached for path, if it did not change since.
+    bool CachedPartETag(const std::string &path, std::string &partETag);
+
+private:
+    struct Pending;
+
+    // The cached or shared ETag of path, or a new one added to pending.
+    std::shared_future<std::string> Start(const std::string &path,
+                                          std::vector<Pending> &pending);
+
+    // Cache and hand out the ETag of a file once it is hashed.
+    void Finish(const Pending &file, const std::string &etag);
+
+    FixedThreadPoolExecutor pool_;
+
+    std::mutex mtx_;
+    std::unordered_map<std::string, std::shared_future<std::string>> hashing_;
+};
+
+HashService *hashService();
@@ -0,0 +1,348 @@
+#include "http_engine.h"
+
+#include <curl/curl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+struct HttpEngine::Loop {
+    CURLM *multi{nullptr};
+    std::thread thread;
+    std::mutex mtx;
+    // Handed over by other threads, started by the loop on its next turn.
+    std::vector<Transfer *> incoming;
+    bool stopped{false};
+    // Only touched by the loop thread.
+    std::unordered_set<Transfer *> running;
+    std::atomic<size_t> active{0};
+
+    // Returns false without queuing if the loop already stopped.
+    bool Add(Transfer *transfer);
+    void Stop();
+    void Run();
+    void Start(Transfer *transfer);
+    void Finish(Transfer *transfer, CURLcode result);
+    void Fail(Transfer *transfer, const char *error);
+
+    static size_t OnRead(char *buf, size_t size, size_t n, void *userdata);
+    static size_t OnWrite(char *data, size_t size, size_t n, void *userdata);
+    static size_t OnHeader(char *data, size_t size, size_t n, void *userdata);
+    static int OnProgress(void *userdata,
+                          curl_off_t dltotal,
+                          curl_off_t dlnow,
+                          curl_off_t ultotal,
+                          curl_off_t ulnow);
+};
+
+bool HttpEngine::Loop::Add(Transfer *transfer) {
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        if (!stopped) {
+            incoming.push_back(transfer);
+            active++;
+            curl_multi_wakeup(multi);
+            return true;
+        }
+    }
+    transfer->response_.code = 0;
+    transfer->response_.error = "shut down";
+    return false;
+}
+
+void HttpEngine::Loop::Stop() {
+    std::lock_guard<std::mutex> lck(mtx);
+    stopped = true;
+    curl_multi_wakeup(multi);
+}
+
+void HttpEngine::Loop::Run() {
+    std::vector<Transfer *> added;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            if (stopped) {
+                added.swap(incoming);
+                break;
+            }
+            added.swap(incoming);
+        }
+        for (Transfer *transfer : added) {
+            Start(transfer);
+        }
+        added.clear();
+
+        int stillRunning = 0;
+        curl_multi_perform(multi, &stillRunning);
+        int queued = 0;
+        while (CURLMsg *msg = curl_multi_info_read(multi, &queued)) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            char *priv = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &priv);
+            auto *transfer = reinterpret_cast<Transfer *>(priv);
+            // msg goes away with the handle, which Finish removes.
+            CURLcode result = msg->data.result;
+            Finish(transfer, result);
+        }
+        curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+    }
+
+    for (Transfer *transfer : added) {
+        Fail(transfer, "shut down");
+    }
+    while (!running.empty()) {
+        Transfer *transfer = *running.begin();
+        curl_multi_remove_handle(multi, static_cast<CURL *>(transfer->easy_));
+        curl_easy_cleanup(static_cast<CURL *>(transfer->easy_));
+        transfer->easy_ = nullptr;
+        running.erase(transfer);
+        Fail(transfer, "shut down");
+    }
+}
+
+void HttpEngine::Loop::Start(Transfer *transfer) {
+    HttpRequest &request = transfer->request_;
+    if (request.token.cancelled()) {
+        Fail(transfer, "cancelled");
+        return;
+    }
+    CURL *easy = curl_easy_init();
+    if (!easy) {
+        Fail(transfer, "out of memory");
+        return;
+    }
+    transfer->easy_ = easy;
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, transfer);
+    curl_easy_setopt(easy, CURLOPT_URL, request.url.c_str());
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT_MS, 5000L);
+    // Like the SDK requestTimeoutMs, give up on a stalled transfer only.
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, 180L);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, OnWrite);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, transfer);
+    curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, OnHeader);
+    curl_easy_setopt(easy, CURLOPT_HEADERDATA, transfer);
+    curl_easy_setopt(easy, CURLOPT_XFERINFOFUNCTION, OnProgress);
+    curl_easy_setopt(easy, CURLOPT_XFERINFODATA, transfer);
+    curl_easy_setopt(easy, CURLOPT_NOPROGRESS, 0L);
+
+    if (request.method == "HEAD") {
+        curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+    } else if (request.method == "PUT") {
+        size_t size = request.bodyFd >= 0 ? request.bodySize
+                                          : request.body.size();
+        curl_easy_setopt(easy, CURLOPT_UPLOAD, 1L);
+        curl_easy_setopt(easy, CURLOPT_INFILESIZE_LARGE, curl_off_t(size));
+        curl_easy_setopt(easy, CURLOPT_READFUNCTION, OnRead);
+        curl_easy_setopt(easy, CURLOPT_READDATA, transfer);
+    } else if (request.method != "GET") {
+        curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+        if (!request.body.empty()) {
+            curl_easy_setopt(easy, CURLOPT_POSTFIELDS, request.body.c_str());
+            curl_easy_setopt(easy,
+                             CURLOPT_POSTFIELDSIZE_LARGE,
+                             curl_off_t(request.body.size()));
+        }
+    }
+
+    curl_slist *headers = nullptr;
+    for (const auto &header : request.headers) {
+        headers = curl_slist_append(headers, header.c_str());
+    }
+    // Do not wait a second for 100 Continue before every upload.
+    headers = curl_slist_append(headers, "Expect:");
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+
+    curl_slist *connectTo = nullptr;
+    if (!request.connectTo.empty()) {
+        connectTo = curl_slist_append(nullptr,
+                                      ("::" + request.connectTo).c_str());
+        curl_easy_setopt(easy, CURLOPT_CONNECT_TO, connectTo);
+    }
+    // curl copies neither list, they are freed with the handle in Finish.
+    transfer->headers_ = headers;
+    transfer->connectTo_ = connectTo;
+
+    running.insert(transfer);
+    curl_multi_add_handle(multi, easy);
+}
+
+void HttpEngine::Loop::Finish(Transfer *transfer, CURLcode result) {
+    HttpResponse &response = transfer->response_;
+    if (result == CURLE_OK) {
+        curl_easy_getinfo(static_cast<CURL *>(transfer->easy_),
+                          CURLINFO_RESPONSE_CODE,
+                          &response.code);
+    } else {
+        response.code = 0;
+        response.error = transfer->request_.token.cancelled()
+                                 ? "cancelled"
+                                 : curl_easy_strerror(result);
+    }
+    curl_multi_remove_handle(multi, static_cast<CURL *>(transfer->easy_));
+    curl_easy_cleanup(static_cast<CURL *>(transfer->easy_));
+    transfer->easy_ = nullptr;
+    running.erase(transfer);
+    Fail(transfer, nullptr);
+}
+
+void HttpEngine::Loop::Fail(Transfer *transfer, const char *error) {
+    curl_slist_free_all(static_cast<curl_slist *>(transfer->headers_));
+    curl_slist_free_all(static_cast<curl_slist *>(transfer->connectTo_));
+    transfer->headers_ = nullptr;
+    transfer->connectTo_ = nullptr;
+    if (error) {
+        transfer->response_.code = 0;
+        transfer->response_.error = error;
+    }
+    active--;
+    transfer->handle_.resume();
+}
+
+size_t HttpEngine::Loop::OnRead(char *buf,
+                                size_t size,
+                                size_t n,
+                                void *userdata) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+    HttpRequest &request = transfer->request_;
+    if (request.token.cancelled()) {
+        return CURL_READFUNC_ABORT;
+    }
+    size_t want = size * n;
+    if (request.bodyFd < 0) {
+        size_t count = std::min(want, request.body.size() - transfer->sent_);
+        memcpy(buf, request.body.data() + transfer->sent_, count);
+        transfer->sent_ += count;
+        return count;
+    }
+    size_t count = std::min(want, request.bodySize - transfer->sent_);
+    for (;;) {
+        ssize_t r = ::pread(request.bodyFd,
+                            buf,
+                            count,
+                            request.bodyOffset + transfer->sent_);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0 || (r == 0 && count > 0)) {
+            return CURL_READFUNC_ABORT;
+        }
+        transfer->sent_ += r;
+        return r;
+    }
+}
+
+size_t HttpEngine::Loop::OnWrite(char *data,
+                                 size_t size,
+                                 size_t n,
+                                 void *userdata) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+    HttpRequest &request = transfer->request_;
+    size_t count = size * n;
+    if (request.token.cancelled()) {
+        return 0;
+    }
+    // Error documents go to the body even when onData takes the content.
+    long code = 0;
+    curl_easy_getinfo(static_cast<CURL *>(transfer->easy_),
+                      CURLINFO_RESPONSE_CODE,
+                      &code);
+    if (request.onData && code / 100 == 2) {
+        return request.onData(data, count) ? count : 0;
+    }
+    transfer->response_.body.append(data, count);
+    return count;
+}
+
+size_t HttpEngine::Loop::OnHeader(char *data,
+                                  size_t size,
+                                  size_t n,
+                                  void *userdata) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+    size_t count = size * n;
+    std::string line(data, count);
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+        line.pop_back();
+    }
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        // A new response, after 100 Continue or a redirect.
+        transfer->response_.headers.clear();
+        return count;
+    }
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+        return count;
+    }
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), [](char c) {
+        return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+    });
+    size_t begin = line.find_first_not_of(' ', colon + 1);
+    transfer->response_.headers[name] =
+            begin == std::string::npos ? "" : line.substr(begin);
+    return count;
+}
+
+int HttpEngine::Loop::OnProgress(void *userdata,
+                                 curl_off_t,
+                                 curl_off_t,
+                                 curl_off_t,
+                                 curl_off_t) {
+    auto *transfer = static_cast<Transfer *>(userdata);
+    return transfer->request_.token.cancelled() ? 1 : 0;
+}
+
+bool HttpEngine::Transfer::await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    return loop_->Add(this);
+}
+
+HttpEngine::HttpEngine(size_t loops, size_t maxHostConnections) {
+    loops = std::max<size_t>(loops, 1);
+    // Split the budget, every loop keeps its own connections.
+    long perLoop = long(std::max<size_t>(maxHostConnections / loops, 1));
+    for (size_t i = 0; i < loops; i++) {
+        std::unique_ptr<Loop> loop(new Loop);
+        loop->multi = curl_multi_init();
+        curl_multi_setopt(loop->multi, CURLMOPT_MAX_HOST_CONNECTIONS, perLoop);
+        loop->thread = std::thread(&Loop::Run, loop.get());
+        loops_.push_back(std::move(loop));
+    }
+}
+
+HttpEngine::~HttpEngine() {
+    Shutdown();
+    for (auto &loop : loops_) {
+        if (loop->thread.joinable()) {
+            loop->thread.join();
+        }
+        curl_multi_cleanup(loop->multi);
+    }
+}
+
+HttpEngine::Transfer HttpEngine::Perform(HttpRequest &request,
+                                         HttpResponse &response) {
+    Loop *loop = loops_[next_++ % loops_.size()].get();
+    return Transfer(loop, request, response);
+}
+
+void HttpEngine::Shutdown() {
+    for (auto &loop : loops_) {
+        loop->Stop();
+    }
+}
+
+size_t HttpEngine::active() const {
+    size_t n = 0;
+    for (const auto &loop : loops_) {
+        n += loop->active;
+    }
+    return n;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cancellation.h"
+
+struct HttpRequest {
+    std::string method{"GET"};
+    std::string url;
+    // "Name: value" lines.
+    std::vector<std::string> headers;
+    // Body of a PUT, bodySize bytes of bodyFd from bodyOffset when bodyFd is
+    // not negative, or else body.
+    std::string body;
+    int bodyFd{-1};
+    size_t bodyOffset{0};
+    size_t bodySize{0};
+    // Receives the response body instead of HttpResponse::body when set,
+    // returning false aborts the transfer.
+    std::function<bool(const char *data, size_t size)> onData;
+    // host:port to connect to instead of the host of url, for a local
+    // stand-in of a server.
+    std::string connectTo;
+    // The transfer is aborted once it is cancelled.
+    CancellationToken token;
+};
+
+struct HttpResponse {
+    // The HTTP status, zero when the transfer itself failed.
+    long code{0};
+    // Names in lower case.
+    std::map<std::string, std::string> headers;
+    std::string body;
+    // Why the transfer failed, when code is zero.
+    std::string error;
+};
+
+/**
+ * Runs HTTP transfers on a few event loop threads, each driving a curl multi
+ * handle, so thousands of requests in flight do not need a thread each.
+ * A coroutine awaits Perform and resumes in the loop thread once the
+ * transfer finished. Resumed coroutines hold up the other transfers of their
+ * loop, so they should only start the next request or hop to an executor.
+ */
+class HttpEngine {
+    struct Loop;
+
+public:
+    // At most maxHostConnections connections to one host over all loops.
+    HttpEngine(size_t loops, size_t maxHostConnections);
+    ~HttpEngine();
+
+    HttpEngine(const HttpEngine &) = delete;
+    HttpEngine &operator=(const HttpEngine &) = delete;
+
+    class Transfer {
+    public:
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        void await_resume() const noexcept {}
+
+    private:
+        friend class HttpEngine;
+        friend struct HttpEngine::Loop;
+
+        Transfer(Loop *loop, HttpRequest &request, HttpResponse &response)
+            : loop_(loop), request_(request), response_(response) {}
+
+        Loop *loop_;
+        HttpRequest &request_;
+        HttpResponse &response_;
+        std::coroutine_handle<> handle_;
+        // The curl easy handle and header lists while it runs.
+        void *easy_{nullptr};
+        void *headers_{nullptr};
+        void *connectTo_{nullptr};
+        size_t sent_{0};
+    };
+
+    /**
+     * Awaitable sending request and storing the result to response, both
+     * must stay alive until it resumes. Failures only show in response.
+     */
+    Transfer Perform(HttpRequest &request, HttpResponse &response);
+
+    // Fail the transfers in flight and every later one, and stop the loops.
+    void Shutdown();
+
+    // Transfers in flight over all loops.
+    size_t active() const;
+
+private:
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::atomic<size_t> next_{0};
+};
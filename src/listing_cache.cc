@@ -0,0 +1,109 @@
+#include "listing_cache.h"
+
+#include "options.h"
+
+#include <algorithm>
+
+namespace {
+// A Dir sharing the files of dir, without its compare state.
+DirPtr CopyListing(const Dir &dir) {
+    DirPtr copy(new Dir(dir.path));
+    copy->tag = dir.tag;
+    copy->dirCount = dir.dirCount;
+    copy->fileCount = dir.fileCount;
+    copy->totalSize = dir.totalSize;
+    copy->files = dir.files;
+    return copy;
+}
+
+size_t ListingBytes(const Dir &dir) {
+    size_t bytes = sizeof(Dir) + dir.path.size();
+    for (const auto &file : dir.files) {
+        // The File, its control block and the pointer to it.
+        bytes += sizeof(File) + 16 + sizeof(FilePtr) + file->name.size() +
+                 file->stat.etag.size() + file->stat.partETag.size() +
+                 file->location.size();
+    }
+    return bytes;
+}
+} // namespace
+
+uint64_t ListingCache::Version() {
+    std::lock_guard<std::mutex> lck(mtx_);
+    return version_;
+}
+
+DirPtr ListingCache::Get(const std::string &site,
+                         const std::string &path,
+                         bool &fresh) {
+    std::lock_guard<std::mutex> lck(mtx_);
+    auto it = entries_.find({site, path});
+    if (it == entries_.end() || !it->second.dir) {
+        return nullptr;
+    }
+    Entry &entry = it->second;
+    lru_.splice(lru_.begin(), lru_, entry.lru);
+    auto ttl = std::chrono::seconds(
+            options().get_int(OPTION_LISTING_CACHE_TTL));
+    fresh = Clock::now() - entry.listed < ttl;
+    return CopyListing(*entry.dir);
+}
+
+void ListingCache::Put(const std::string &site,
+                       const std::string &path,
+                       const DirPtr &dir,
+                       uint64_t version) {
+    std::lock_guard<std::mutex> lck(mtx_);
+    auto it = entries_.find({site, path});
+    if (it != entries_.end() && it->second.version > version) {
+        return;
+    }
+    Entry &entry = Touch({site, path});
+    entry.dir = CopyListing(*dir);
+    entry.listed = Clock::now();
+    bytes_ -= entry.bytes;
+    entry.bytes = ListingBytes(*dir);
+    bytes_ += entry.bytes;
+    Evict();
+}
+
+void ListingCache::Invalidate(const std::string &site,
+                              const std::string &path) {
+    std::lock_guard<std::mutex> lck(mtx_);
+    Entry &entry = Touch({site, path});
+    entry.dir.reset();
+    bytes_ -= entry.bytes;
+    entry.bytes = sizeof(Entry) + site.size() + path.size();
+    bytes_ += entry.bytes;
+    Evict();
+}
+
+ListingCache::Entry &ListingCache::Touch(const Key &key) {
+    auto [it, added] = entries_.try_emplace(key);
+    Entry &entry = it->second;
+    if (added) {
+        lru_.push_front(&it->first);
+        entry.lru = lru_.begin();
+    } else {
+        lru_.splice(lru_.begin(), lru_, entry.lru);
+    }
+    entry.version = ++version_;
+    return entry;
+}
+
+void ListingCache::Evict() {
+    size_t budget = static_cast<size_t>(std::max(
+                            options().get_int(OPTION_LISTING_CACHE_SIZE), 0))
+                    << 20;
+    while (bytes_ > budget && !lru_.empty()) {
+        auto it = entries_.find(*lru_.back());
+        bytes_ -= it->second.bytes;
+        lru_.pop_back();
+        entries_.erase(it);
+    }
+}
+
+ListingCache *listingCache() {
+    static ListingCache inst;
+    return &inst;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "site.h"
+
+/**
+ * Listings of directories shared by all sites, so a tab going to a path
+ * another one listed a moment ago shows it without listing it again. A
+ * listing is fresh for OPTION_LISTING_CACHE_TTL seconds, after which it is
+ * still shown but listed again. The least recently used listings are
+ * dropped beyond OPTION_LISTING_CACHE_SIZE MB, and DirectoryCenter drops the
+ * listing of a directory once it is updated.
+ */
+class ListingCache {
+public:
+    // The version to Put a listing started now with.
+    uint64_t Version();
+
+    /**
+     * A Dir of its own with the files listed for path of site, null if none
+     * is kept. fresh tells whether it is younger than the TTL.
+     */
+    DirPtr Get(const std::string &site, const std::string &path, bool &fresh);
+
+    // Keep dir listed for path of site, started at version, unless the path
+    // was put or invalidated since.
+    void Put(const std::string &site,
+             const std::string &path,
+             const DirPtr &dir,
+             uint64_t version);
+
+    void Invalidate(const std::string &site, const std::string &path);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Key = std::pair<std::string, std::string>;
+
+    // An invalidated path keeps its entry without dir, so a listing started
+    // before is not put.
+    struct Entry {
+        DirPtr dir;
+        Clock::time_point listed;
+        size_t bytes{0};
+        uint64_t version{0};
+        std::list<const Key *>::iterator lru;
+    };
+
+    Entry &Touch(const Key &key);
+    void Evict();
+
+    std::mutex mtx_;
+    uint64_t version_{0};
+    size_t bytes_{0};
+    std::map<Key, Entry> entries_;
+    // Keys of entries_, the most recently used first.
+    std::list<const Key *> lru_;
+};
+
+ListingCache *listingCache();
@@ -1,6 +1,11 @@
 #include "local_site.h"
+#include "hash_service.h"
 #include "oss_client.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <filesystem>
 #include <fstream>
 #include <regex>
@@ -35,7 +40,6 @@ Status LocalSite::GetLocalDir(const std::string &path,
             continue;
         }
         FilePtr file(new File);
-        file->cmp = CSNone;
         file->name = std::move(filename);
         auto t = e.last_write_time(ec);
         if (ec) {
@@ -82,6 +86,44 @@ Status LocalSite::SetLastModifiedTime(const std::string &path, time_t tm) {
     return Status::OK();
 }
 
+Status LocalSite::OpenPreallocated(const std::string &path,
+                                   size_t size,
+                                   bool fresh,
+                                   int &fd) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (fresh ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        return Status(EC_FAIL, "");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        fd = -1;
+        return Status(EC_FAIL, "");
+    }
+    if ((size_t)st.st_size != size) {
+        // Reserving the blocks up front is only a hint, the file is sized by
+        // ftruncate anyway, which also drops the bytes of a larger file.
+        if ((size_t)st.st_size < size) {
+#ifdef __APPLE__
+            fstore_t store = {F_ALLOCATEALL,
+                              F_PEOFPOSMODE,
+                              0,
+                              (off_t)(size - st.st_size),
+                              0};
+            ::fcntl(fd, F_PREALLOCATE, &store);
+#elif defined(__linux__)
+            ::posix_fallocate(fd, st.st_size, size - st.st_size);
+#endif
+        }
+        if (::ftruncate(fd, size) != 0) {
+            ::close(fd);
+            fd = -1;
+            return Status(EC_FAIL, "");
+        }
+    }
+    return Status::OK();
+}
+
 Status LocalSite::RemoveLocalDir(const std::string &path) {
     std::error_code ec;
     fs::remove_all(path, ec);
@@ -160,7 +202,7 @@ std::string LocalSite::GetParentPath() const {
 }
 
 std::string LocalSite::GetETag(const std::string &path) const {
-    return GetETagStatic(path);
+    return hashService()->ContentETag(path).get();
 }
 
 std::string LocalSite::GetETagStatic(const std::string &path) {
@@ -18,6 +18,12 @@ public:
     static Status MakeLocalDir(const std::string &path);
     static Status RemoveLocalDir(const std::string &path);
     static Status SetLastModifiedTime(const std::string &path, time_t tm);
+    // Open path for positional writes, sized to size. A fresh file starts
+    // empty, otherwise the bytes within size are kept.
+    static Status OpenPreallocated(const std::string &path,
+                                   size_t size,
+                                   bool fresh,
+                                   int &fd);
 
     Status GetDir(const std::string &path, DirPtr &dir) override;
     Status MakeDir(const std::string &path) override;
@@ -33,7 +39,9 @@ public:
 
     std::string GetParentPath() const override;
 
+    // Hashed on the hash service, the calling thread only waits.
     std::string GetETag(const std::string &path) const override;
 
+    // Hash path in the calling thread.
     static std::string GetETagStatic(const std::string &path);
 };
@@ -4,10 +4,14 @@
 #include <wx/imagpng.h>
 #include <wx/stdpaths.h>
 
+#include <fstream>
+
 #include "window_state_manager.h"
 
+#include "cancellation.h"
 #include "global_executor.h"
 #include "options.h"
+#include "oss_client.h"
 #include "oss_site_config.h"
 #include "site_manager_dialog.h"
 #include "storage.h"
@@ -23,6 +27,7 @@ enum {
     opID_VIEW_TWINMODE,
     opID_VIEW_TASKLIST,
     opID_CLOSE_ALL,
+    opID_DUMP_STATS,
     opID_SPLITTER_TOP,
     opID_DIFF,
 };
@@ -35,6 +40,7 @@ EVT_MENU(wxID_ANY, MainFrame::OnMenuHandler)
 EVT_MENU(opID_SITE_MANAGER, MainFrame::OnSiteManager)
 EVT_MENU(opID_VIEW_TASKLIST, MainFrame::OnViewTaskList)
 EVT_MENU(opID_CLOSE_ALL, MainFrame::OnCloseAll)
+EVT_MENU(opID_DUMP_STATS, MainFrame::OnDumpStats)
 EVT_SPLITTER_UNSPLIT(opID_SPLITTER_TOP, MainFrame::OnSplitterTopUnsplit)
 EVT_TOOL(wxID_UP, MainFrame::OnUp)
 EVT_TOOL(wxID_BACKWARD, MainFrame::OnBackward)
@@ -71,6 +77,7 @@ MainFrame::MainFrame() {
     menuFile->Append(opID_SCHEDULE_MANAGER, _("Task Manager"));
     menuFile->AppendSeparator();
     menuFile->Append(opID_CLOSE_ALL, _("Close All"));
+    menuFile->Append(opID_DUMP_STATS, _("Dump Statistics..."));
     menuFile->Append(wxID_EXIT);
     menuBar->Append(menuFile, _("File"));
 
@@ -230,6 +237,10 @@ void MainFrame::OnClose(wxCloseEvent &event) {
     options().set(OPTION_LASTOPEN_SITES, openSites);
     options().set(OPTION_LASTOPEN_INDEX, selection);
 
+    // Stop the tasks and abort the requests in flight, so the workers leave
+    // in bounded time.
+    shutdownToken().cancel();
+    DisableOssClients();
     taskList()->Close();
     globalExecutor()->cancel();
 
@@ -373,6 +384,24 @@ void MainFrame::OnCloseAll(wxCommandEvent &event) {
     explorer_->Clear();
 }
 
+void MainFrame::OnDumpStats(wxCommandEvent &event) {
+    wxFileDialog dlg(this,
+                     _("Dump Statistics"),
+                     wxEmptyString,
+                     "osspan-stats.txt",
+                     "*.txt",
+                     wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (dlg.ShowModal() != wxID_OK) {
+        return;
+    }
+    std::ofstream ofs(dlg.GetPath().ToStdString());
+    ofs << Executor::DumpStats();
+    ofs << DumpEndpointStats();
+    if (!ofs) {
+        wxMessageBox(_("Failed to write the statistics"), _("Error"));
+    }
+}
+
 void MainFrame::OnSplitterTopUnsplit(wxSplitterEvent &event) {
     options().set(OPTION_SPLITTERTOP_SPLIT, -1);
     GetMenuBar()->Check(opID_VIEW_TASKLIST, false);
@@ -27,6 +27,7 @@ protected:
     void OnSiteManager(wxCommandEvent &event);
     void OnViewTaskList(wxCommandEvent &event);
     void OnCloseAll(wxCommandEvent &event);
+    void OnDumpStats(wxCommandEvent &event);
 
     void OnSplitterTopUnsplit(wxSplitterEvent &event);
 
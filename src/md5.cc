@@ -0,0 +1,386 @@
+#include "md5.h"
+#include "md5_kernel.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+
+static_assert(std::endian::native == std::endian::little,
+              "MD5 words are read in the byte order of the host");
+
+namespace md5_detail {
+namespace {
+
+struct Scalar : RoundFunctions<Scalar> {
+    using T = uint32_t;
+    static constexpr size_t kLanes = 1;
+
+    static T Load(const uint32_t *p) { return *p; }
+    static void Store(uint32_t *p, T v) { *p = v; }
+    static T Set1(uint32_t v) { return v; }
+    static T Add(T a, T b) { return a + b; }
+    static T And(T a, T b) { return a & b; }
+    static T Or(T a, T b) { return a | b; }
+    static T Xor(T a, T b) { return a ^ b; }
+
+    template <int s>
+    static T Rotl(T v) {
+        return std::rotl(v, s);
+    }
+};
+
+} // namespace
+
+void BlocksScalar(uint32_t *state, const uint8_t *const *data, size_t blocks) {
+    Blocks<Scalar>(state, data, blocks);
+}
+
+} // namespace md5_detail
+
+Md5::Md5() {
+    std::copy(md5_detail::kInit, md5_detail::kInit + 4, state_);
+}
+
+Md5::Md5(const uint32_t state[4], uint64_t bytes) : bytes_(bytes) {
+    std::copy(state, state + 4, state_);
+}
+
+void Md5::Update(const void *data, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    size_t used = bytes_ % 64;
+    bytes_ += size;
+    if (used > 0) {
+        size_t take = std::min(64 - used, size);
+        std::memcpy(buffer_ + used, p, take);
+        p += take;
+        size -= take;
+        if (used + take < 64) {
+            return;
+        }
+        const uint8_t *block = buffer_;
+        md5_detail::BlocksScalar(state_, &block, 1);
+    }
+    size_t blocks = size / 64;
+    if (blocks > 0) {
+        md5_detail::BlocksScalar(state_, &p, blocks);
+        p += blocks * 64;
+        size -= blocks * 64;
+    }
+    std::memcpy(buffer_, p, size);
+}
+
+Md5::Digest Md5::Final() {
+    static const uint8_t padding[64] = {0x80};
+    uint64_t bits = bytes_ * 8;
+    size_t used = bytes_ % 64;
+    Update(padding, used < 56 ? 56 - used : 120 - used);
+    uint8_t length[8];
+    for (size_t i = 0; i < 8; i++) {
+        length[i] = uint8_t(bits >> (8 * i));
+    }
+    Update(length, sizeof(length));
+
+    Digest digest;
+    for (size_t i = 0; i < 16; i++) {
+        digest[i] = uint8_t(state_[i / 4] >> (8 * (i % 4)));
+    }
+    return digest;
+}
+
+std::string Md5::ToETag(const Digest &digest) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string etag;
+    etag.reserve(32);
+    for (uint8_t byte : digest) {
+        etag += hex[byte >> 4];
+        etag += hex[byte & 0xf];
+    }
+    return etag;
+}
+
+const std::vector<Md5Kernel> &Md5Kernels() {
+    static const std::vector<Md5Kernel> kernels = []() {
+        std::vector<Md5Kernel> kernels;
+#ifdef MD5_X86_KERNELS
+        if (__builtin_cpu_supports("avx512f")) {
+            kernels.push_back({"avx512", 16, md5_detail::BlocksAvx512});
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            kernels.push_back({"avx2", 8, md5_detail::BlocksAvx2});
+        }
+        kernels.push_back({"sse2", 4, md5_detail::BlocksSse2});
+#endif
+        kernels.push_back({"scalar", 1, md5_detail::BlocksScalar});
+        return kernels;
+    }();
+    return kernels;
+}
+
+size_t Md5Lanes() {
+    return Md5Kernels().front().lanes;
+}
+
+namespace {
+
+// The bytes of a stream a lane has read and not hashed yet.
+struct Lane {
+    bool active{false};
+    size_t index{0};
+    const uint8_t *data{nullptr};
+    size_t size{0};
+    bool eof{false};
+    uint64_t hashed{0};
+};
+
+// Most blocks hashed by one kernel call, lanes without a stream read as
+// many from kIdle.
+constexpr size_t kRunBlocks = 1024;
+const uint8_t kIdle[kRunBlocks * 64] = {};
+
+// Each lane reading a file reads into a chunk of its own.
+constexpr size_t kChunk = kRunBlocks * 64;
+
+/**
+ * Hash count streams of source in the lanes of kernel. Source opens stream
+ * index in a lane, refills the lane once it has less than a block left, and
+ * takes the digest of each stream, null if the stream failed.
+ */
+template <typename Source>
+void HashLanes(const Md5Kernel &kernel, size_t count, Source &source) {
+    const size_t lanes = kernel.lanes;
+    std::vector<Lane> slots(lanes);
+    std::vector<uint32_t> state(4 * lanes);
+    std::vector<const uint8_t *> data(lanes);
+    size_t next = 0;
+
+    // The stream of lane l from where the kernel left it.
+    auto resume = [&](size_t l) {
+        uint32_t s[4];
+        for (size_t i = 0; i < 4; i++) {
+            s[i] = state[i * lanes + l];
+        }
+        return Md5(s, slots[l].hashed);
+    };
+
+    auto finish = [&](size_t l, Md5 *md5) {
+        Lane &lane = slots[l];
+        lane.active = false;
+        if (!md5) {
+            source.Finish(l, lane.index, nullptr);
+            return;
+        }
+        Md5::Digest digest = md5->Final();
+        source.Finish(l, lane.index, &digest);
+    };
+
+    // Until lane l has a block to hash or no stream is left to start, start
+    // streams, refill them and finish those at their end.
+    auto settle = [&](size_t l) {
+        Lane &lane = slots[l];
+        while (true) {
+            if (!lane.active) {
+                if (next == count) {
+                    return;
+                }
+                lane = Lane{true, next++};
+                for (size_t i = 0; i < 4; i++) {
+                    state[i * lanes + l] = md5_detail::kInit[i];
+                }
+                if (!source.Open(l, lane)) {
+                    finish(l, nullptr);
+                    continue;
+                }
+            }
+            if (lane.size >= 64) {
+                return;
+            }
+            if (lane.eof) {
+                Md5 md5 = resume(l);
+                md5.Update(lane.data, lane.size);
+                finish(l, &md5);
+            } else if (!source.Refill(l, lane)) {
+                finish(l, nullptr);
+            }
+        }
+    };
+
+    for (size_t l = 0; l < lanes; l++) {
+        settle(l);
+    }
+    while (true) {
+        size_t active = 0;
+        size_t last = 0;
+        size_t run = kRunBlocks;
+        for (size_t l = 0; l < lanes; l++) {
+            if (slots[l].active) {
+                active++;
+                last = l;
+                run = std::min(run, slots[l].size / 64);
+            }
+        }
+        if (active == 0) {
+            break;
+        }
+        if (active == 1 && next == count) {
+            // Nothing left to hash alongside, the remaining blocks of the
+            // last stream are cheaper without the kernel.
+            Lane &lane = slots[last];
+            Md5 md5 = resume(last);
+            while (true) {
+                md5.Update(lane.data, lane.size);
+                lane.size = 0;
+                if (lane.eof) {
+                    finish(last, &md5);
+                    break;
+                }
+                if (!source.Refill(last, lane)) {
+                    finish(last, nullptr);
+                    break;
+                }
+            }
+            break;
+        }
+        for (size_t l = 0; l < lanes; l++) {
+            data[l] = slots[l].active ? slots[l].data : kIdle;
+        }
+        kernel.blocks(state.data(), data.data(), run);
+        for (size_t l = 0; l < lanes; l++) {
+            Lane &lane = slots[l];
+            if (lane.active) {
+                lane.data += run * 64;
+                lane.size -= run * 64;
+                lane.hashed += run * 64;
+                settle(l);
+            }
+        }
+    }
+}
+
+} // namespace
+
+std::vector<Md5::Digest> Md5Buffers(
+        const std::vector<std::string_view> &buffers,
+        const Md5Kernel &kernel) {
+    struct Source {
+        const std::vector<std::string_view> &buffers;
+        std::vector<Md5::Digest> &digests;
+
+        bool Open(size_t, Lane &lane) {
+            const std::string_view &buffer = buffers[lane.index];
+            lane.data = reinterpret_cast<const uint8_t *>(buffer.data());
+            lane.size = buffer.size();
+            lane.eof = true;
+            return true;
+        }
+
+        bool Refill(size_t, Lane &) { return true; }
+
+        void Finish(size_t, size_t index, const Md5::Digest *digest) {
+            digests[index] = *digest;
+        }
+    };
+
+    std::vector<Md5::Digest> digests(buffers.size());
+    Source source{buffers, digests};
+    HashLanes(kernel, buffers.size(), source);
+    return digests;
+}
+
+std::vector<std::string> Md5FileETags(const std::vector<std::string> &paths) {
+    const Md5Kernel &kernel = Md5Kernels().front();
+
+    struct Source {
+        const std::vector<std::string> &paths;
+        std::vector<std::string> &etags;
+        std::vector<uint8_t> chunks;
+        std::vector<int> fds;
+
+        bool Open(size_t l, Lane &lane) {
+            fds[l] = ::open(paths[lane.index].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fds[l] < 0) {
+                return false;
+            }
+            lane.size = 0;
+            return Refill(l, lane);
+        }
+
+        // Keep the bytes left and read up to a chunk after them.
+        bool Refill(size_t l, Lane &lane) {
+            uint8_t *chunk = &chunks[l * kChunk];
+            if (lane.size > 0) {
+                std::memmove(chunk, lane.data, lane.size);
+            }
+            size_t size = lane.size;
+            while (size < kChunk) {
+                ssize_t n = ::read(fds[l], chunk + size, kChunk - size);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                if (n == 0) {
+                    lane.eof = true;
+                    break;
+                }
+                size += n;
+            }
+            lane.data = chunk;
+            lane.size = size;
+            return true;
+        }
+
+        void Finish(size_t l, size_t index, const Md5::Digest *digest) {
+            if (fds[l] >= 0) {
+                ::close(fds[l]);
+                fds[l] = -1;
+            }
+            if (digest) {
+                etags[index] = Md5::ToETag(*digest);
+            }
+        }
+    };
+
+    std::vector<std::string> etags(paths.size());
+    Source source{paths,
+                  etags,
+                  std::vector<uint8_t>(kernel.lanes * kChunk),
+                  std::vector<int>(kernel.lanes, -1)};
+    HashLanes(kernel, paths.size(), source);
+    return etags;
+}
+
+std::string Md5PartETag(const std::vector<std::string> &partETags) {
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        c |= 0x20;
+        return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    };
+
+    Md5 md5;
+    for (std::string_view etag : partETags) {
+        if (etag.size() == 34 && etag.front() == '"' && etag.back() == '"') {
+            etag = etag.substr(1, 32);
+        }
+        if (etag.size() != 32) {
+            return "";
+        }
+        Md5::Digest digest;
+        for (size_t i = 0; i < digest.size(); i++) {
+            int high = nibble(etag[2 * i]);
+            int low = nibble(etag[2 * i + 1]);
+            if (high < 0 || low < 0) {
+                return "";
+            }
+            digest[i] = uint8_t(high << 4 | low);
+        }
+        md5.Update(digest.data(), digest.size());
+    }
+    return Md5::ToETag(md5.Final()) + "-" + std::to_string(partETags.size());
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// MD5 of one stream.
+class Md5 {
+public:
+    using Digest = std::array<uint8_t, 16>;
+
+    Md5();
+
+    // Continue a stream of which bytes, a multiple of 64, left state.
+    Md5(const uint32_t state[4], uint64_t bytes);
+
+    void Update(const void *data, size_t size);
+
+    Digest Final();
+
+    // Upper case hex of digest, the ETag oss::ComputeContentETag gives.
+    static std::string ToETag(const Digest &digest);
+
+private:
+    uint32_t state_[4];
+    uint64_t bytes_{0};
+    uint8_t buffer_[64];
+};
+
+/**
+ * Hashes lanes independent streams at once, one per SIMD lane. state holds
+ * the four words of every lane, word i of lane l at state[i * lanes + l],
+ * and blocks 64 byte blocks are read from each of data.
+ */
+struct Md5Kernel {
+    const char *name;
+    size_t lanes;
+    void (*blocks)(uint32_t *state, const uint8_t *const *data, size_t blocks);
+};
+
+// The kernels this CPU runs, widest first and the scalar one last.
+const std::vector<Md5Kernel> &Md5Kernels();
+
+// Streams the widest kernel hashes at once.
+size_t Md5Lanes();
+
+/**
+ * Digests of buffers, kernel.lanes of them hashed at once. A lane whose
+ * buffer is done takes the next one, and the last buffer left is finished
+ * without the kernel.
+ */
+std::vector<Md5::Digest> Md5Buffers(
+        const std::vector<std::string_view> &buffers,
+        const Md5Kernel &kernel);
+
+/**
+ * ETags of the files of paths, hashed like Md5Buffers with the widest kernel
+ * in the calling thread. Empty for a file that can not be read.
+ */
+std::vector<std::string> Md5FileETags(const std::vector<std::string> &paths);
+
+/**
+ * The ETag OSS gives a multipart upload of parts with partETags, the ETags
+ * it gave their uploads: the MD5 of the part MD5s, then a dash and the part
+ * count. Empty if one is not an MD5, quoted or not.
+ */
+std::string Md5PartETag(const std::vector<std::string> &partETags);
@@ -0,0 +1,41 @@
+// Built with -mavx2, only called once the CPU is known to have it.
+
+#include "md5_kernel.h"
+
+#ifdef MD5_X86_KERNELS
+
+#include <immintrin.h>
+
+namespace md5_detail {
+namespace {
+
+struct Avx2 : RoundFunctions<Avx2> {
+    using T = __m256i;
+    static constexpr size_t kLanes = 8;
+
+    static T Load(const uint32_t *p) {
+        return _mm256_loadu_si256((const T *)p);
+    }
+    static void Store(uint32_t *p, T v) { _mm256_storeu_si256((T *)p, v); }
+    static T Set1(uint32_t v) { return _mm256_set1_epi32(int(v)); }
+    static T Add(T a, T b) { return _mm256_add_epi32(a, b); }
+    static T And(T a, T b) { return _mm256_and_si256(a, b); }
+    static T Or(T a, T b) { return _mm256_or_si256(a, b); }
+    static T Xor(T a, T b) { return _mm256_xor_si256(a, b); }
+
+    template <int s>
+    static T Rotl(T v) {
+        return _mm256_or_si256(_mm256_slli_epi32(v, s),
+                               _mm256_srli_epi32(v, 32 - s));
+    }
+};
+
+} // namespace
+
+void BlocksAvx2(uint32_t *state, const uint8_t *const *data, size_t blocks) {
+    Blocks<Avx2>(state, data, blocks);
+}
+
+} // namespace md5_detail
+
+#endif
@@ -0,0 +1,53 @@
+// Built with -mavx512f, only called once the CPU is known to have it.
+
+#include "md5_kernel.h"
+
+#ifdef MD5_X86_KERNELS
+
+#include <immintrin.h>
+
+namespace md5_detail {
+namespace {
+
+// Rotates and the round functions are single instructions here.
+struct Avx512 {
+    using T = __m512i;
+    static constexpr size_t kLanes = 16;
+
+    static T Load(const uint32_t *p) { return _mm512_loadu_si512(p); }
+    static void Store(uint32_t *p, T v) { _mm512_storeu_si512(p, v); }
+    static T Set1(uint32_t v) { return _mm512_set1_epi32(int(v)); }
+    static T Add(T a, T b) { return _mm512_add_epi32(a, b); }
+
+    template <int s>
+    static T Rotl(T v) {
+        return _mm512_rol_epi32(v, s);
+    }
+
+    // b ? c : d
+    static T F(T b, T c, T d) {
+        return _mm512_ternarylogic_epi32(b, c, d, 0xca);
+    }
+    // d ? b : c
+    static T G(T b, T c, T d) {
+        return _mm512_ternarylogic_epi32(d, b, c, 0xca);
+    }
+    // b ^ c ^ d
+    static T H(T b, T c, T d) {
+        return _mm512_ternarylogic_epi32(b, c, d, 0x96);
+    }
+    // c ^ (b | ~d)
+    static T I(T b, T c, T d) {
+        return _mm512_ternarylogic_epi32(b, c, d, 0x39);
+    }
+};
+
+} // namespace
+
+void BlocksAvx512(uint32_t *state, const uint8_t *const *data, size_t blocks) {
+    Blocks<Avx512>(state, data, blocks);
+}
+
+} // namespace md5_detail
+
+#endif
@@ -0,0 +1,152 @@
+#pragma once
+
+// The rounds of MD5 over a vector of lanes, included by the kernels only.
+// Each kernel is compiled for its instruction set and instantiates Blocks
+// with traits of its own, which give the vector type T, kLanes, and Load,
+// Store, Set1, Add, Rotl and the round functions F, G, H and I.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MD5_X86_KERNELS 1
+#endif
+
+namespace md5_detail {
+
+constexpr uint32_t kK[64] = {
+        0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf,
+        0x4787c62a, 0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af,
+        0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e,
+        0x49b40821, 0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+        0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8, 0x21e1cde6,
+        0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+        0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122,
+        0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+        0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039,
+        0xe6db99e5, 0x1fa27cf8, 0xc4ac5665, 0xf4292244, 0x432aff97,
+        0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d,
+        0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+        0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+constexpr int kShifts[4][4] = {
+        {7, 12, 17, 22},
+        {5, 9, 14, 20},
+        {4, 11, 16, 23},
+        {6, 10, 15, 21},
+};
+
+constexpr uint32_t kInit[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+// The message word step i reads.
+constexpr size_t WordOf(size_t i) {
+    switch (i / 16) {
+    case 0:
+        return i;
+    case 1:
+        return (5 * i + 1) % 16;
+    case 2:
+        return (3 * i + 5) % 16;
+    default:
+        return (7 * i) % 16;
+    }
+}
+
+// Step i, the registers taking the roles of a, b, c and d turn each step.
+template <typename V, size_t i>
+inline void Step(typename V::T (&r)[4], const uint32_t (*w)[V::kLanes]) {
+    using T = typename V::T;
+    T &a = r[(4 - i % 4) % 4];
+    T b = r[(5 - i % 4) % 4];
+    T c = r[(6 - i % 4) % 4];
+    T d = r[(7 - i % 4) % 4];
+    T f;
+    if constexpr (i < 16) {
+        f = V::F(b, c, d);
+    } else if constexpr (i < 32) {
+        f = V::G(b, c, d);
+    } else if constexpr (i < 48) {
+        f = V::H(b, c, d);
+    } else {
+        f = V::I(b, c, d);
+    }
+    T x = V::Add(V::Load(w[WordOf(i)]), V::Set1(kK[i]));
+    a = V::Add(b, V::template Rotl<kShifts[i / 16][i % 4]>(
+                          V::Add(V::Add(a, f), x)));
+}
+
+template <typename V, size_t... i>
+inline void Steps(typename V::T (&r)[4],
+                  const uint32_t (*w)[V::kLanes],
+                  std::index_sequence<i...>) {
+    (Step<V, i>(r, w), ...);
+}
+
+template <typename V>
+void Blocks(uint32_t *state, const uint8_t *const *data, size_t blocks) {
+    constexpr size_t lanes = V::kLanes;
+    using T = typename V::T;
+    const uint8_t *p[lanes];
+    for (size_t l = 0; l < lanes; l++) {
+        p[l] = data[l];
+    }
+    T r[4];
+    for (size_t i = 0; i < 4; i++) {
+        r[i] = V::Load(state + i * lanes);
+    }
+    // Word j of every lane side by side, so a step loads it as one vector.
+    alignas(64) uint32_t w[16][lanes];
+    for (size_t n = 0; n < blocks; n++) {
+        for (size_t l = 0; l < lanes; l++) {
+            for (size_t j = 0; j < 16; j++) {
+                std::memcpy(&w[j][l], p[l] + j * 4, 4);
+            }
+            p[l] += 64;
+        }
+        T s[4] = {r[0], r[1], r[2], r[3]};
+        Steps<V>(r, w, std::make_index_sequence<64>());
+        for (size_t i = 0; i < 4; i++) {
+            r[i] = V::Add(r[i], s[i]);
+        }
+    }
+    for (size_t i = 0; i < 4; i++) {
+        V::Store(state + i * lanes, r[i]);
+    }
+}
+
+// F, G, H and I from the plain bit operations of V.
+template <typename V>
+struct RoundFunctions {
+    template <typename T>
+    static T F(T b, T c, T d) {
+        return V::Xor(d, V::And(b, V::Xor(c, d)));
+    }
+
+    template <typename T>
+    static T G(T b, T c, T d) {
+        return V::Xor(c, V::And(d, V::Xor(b, c)));
+    }
+
+    template <typename T>
+    static T H(T b, T c, T d) {
+        return V::Xor(b, V::Xor(c, d));
+    }
+
+    template <typename T>
+    static T I(T b, T c, T d) {
+        return V::Xor(c, V::Or(b, V::Xor(d, V::Set1(0xffffffff))));
+    }
+};
+
+void BlocksScalar(uint32_t *state, const uint8_t *const *data, size_t blocks);
+
+#ifdef MD5_X86_KERNELS
+void BlocksSse2(uint32_t *state, const uint8_t *const *data, size_t blocks);
+void BlocksAvx2(uint32_t *state, const uint8_t *const *data, size_t blocks);
+void BlocksAvx512(uint32_t *state, const uint8_t *const *data, size_t blocks);
+#endif
+
+} // namespace md5_detail
@@ -0,0 +1,36 @@
+#include "md5_kernel.h"
+
+#ifdef MD5_X86_KERNELS
+
+#include <emmintrin.h>
+
+namespace md5_detail {
+namespace {
+
+struct Sse2 : RoundFunctions<Sse2> {
+    using T = __m128i;
+    static constexpr size_t kLanes = 4;
+
+    static T Load(const uint32_t *p) { return _mm_loadu_si128((const T *)p); }
+    static void Store(uint32_t *p, T v) { _mm_storeu_si128((T *)p, v); }
+    static T Set1(uint32_t v) { return _mm_set1_epi32(int(v)); }
+    static T Add(T a, T b) { return _mm_add_epi32(a, b); }
+    static T And(T a, T b) { return _mm_and_si128(a, b); }
+    static T Or(T a, T b) { return _mm_or_si128(a, b); }
+    static T Xor(T a, T b) { return _mm_xor_si128(a, b); }
+
+    template <int s>
+    static T Rotl(T v) {
+        return _mm_or_si128(_mm_slli_epi32(v, s), _mm_srli_epi32(v, 32 - s));
+    }
+};
+
+} // namespace
+
+void BlocksSse2(uint32_t *state, const uint8_t *const *data, size_t blocks) {
+    Blocks<Sse2>(state, data, blocks);
+}
+
+} // namespace md5_detail
+
+#endif
@@ -0,0 +1,458 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "blocking_queue.h"
+
+/**
+ * Bounded multi producer multi consumer queue on a ring buffer, with the
+ * status semantics of BlockingQueue. Every cell carries a sequence number
+ * telling whether it is free for position p (seq == p) or holds the value
+ * of position p (seq == p + 1), so producers and consumers only race on the
+ * position counters with CAS and never take a lock while the queue is
+ * neither full nor empty. Blocked callers park on a condition variable
+ * which the other side only touches when somebody is parked.
+ *
+ * push_bulk and pop_bulk claim a run of cells with one CAS, so a stage can
+ * hand over a whole batch of listing entries for the price of one item.
+ * Single item push and pop are slower than BlockingQueue in
+ * bench/queue_contention, producers block on the bounded ring where
+ * BlockingQueue just grows, so use it for the bulk calls.
+ *
+ * After shutdown pops drain the ring, including the cells producers claimed
+ * before it and are still filling, and only then report kShutdown.
+ */
+template <typename T> class MpmcQueue {
+public:
+    using Status = typename BlockingQueue<T>::Status;
+    static constexpr Status kOk = BlockingQueue<T>::kOk;
+    static constexpr Status kEmpty = BlockingQueue<T>::kEmpty;
+    static constexpr Status kFull = BlockingQueue<T>::kFull;
+    static constexpr Status kShutdown = BlockingQueue<T>::kShutdown;
+    static constexpr Status kTerminated = BlockingQueue<T>::kTerminated;
+
+    // The capacity is rounded up to a power of two.
+    explicit MpmcQueue(size_t capacity = 1024) {
+        size_t n = 2;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        mask_ = n - 1;
+        cells_.reset(new Cell[n]);
+        for (size_t i = 0; i < n; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Wait while the queue is full.
+    Status push(T &&v) {
+        return PushWait([&v](T &cell) { cell = std::move(v); });
+    }
+
+    Status push(const T &v) {
+        return PushWait([&v](T &cell) { cell = v; });
+    }
+
+    // Like push, but returns kFull instead of waiting.
+    Status try_push(T &&v) {
+        Status status = this->status();
+        if (status >= kShutdown) {
+            return status;
+        }
+        auto assign = [&v](T &cell) { cell = std::move(v); };
+        if (!TryPush(assign)) {
+            return kFull;
+        }
+        WakeConsumers();
+        return kOk;
+    }
+
+    /**
+     * Push the values of [first, last), moving them, and wait for space when
+     * full. On shutdown the values not pushed yet are left in the range,
+     * pushed tells how many were.
+     */
+    template <typename It>
+    Status push_bulk(It first, It last, size_t *pushed) {
+        size_t total = 0;
+        Status status = kOk;
+        while (first != last) {
+            status = this->status();
+            if (status >= kShutdown) {
+                break;
+            }
+            size_t n = TryPushBulk(first, last);
+            if (n) {
+                total += n;
+                WakeConsumers(n);
+                continue;
+            }
+            std::unique_lock<std::mutex> lck(mtx_);
+            producersWaiting_.fetch_add(1);
+            not_full_cv_.wait(lck, [this]() {
+                return !Full() || status_ >= kShutdown;
+            });
+            producersWaiting_.fetch_sub(1);
+        }
+        if (pushed) {
+            *pushed = total;
+        }
+        return first == last ? kOk : status;
+    }
+
+    template <typename It> Status push_bulk(It first, It last) {
+        return push_bulk(first, last, nullptr);
+    }
+
+    Status pop(T &value) {
+        for (;;) {
+            Status status = this->status();
+            if (status == kTerminated) {
+                return kTerminated;
+            }
+            if (TryPop(value)) {
+                WakeProducers();
+                return kOk;
+            }
+            if (Filling()) {
+                continue;
+            }
+            if (status == kShutdown) {
+                return kShutdown;
+            }
+            std::unique_lock<std::mutex> lck(mtx_);
+            consumersWaiting_.fetch_add(1);
+            not_empty_cv_.wait(lck, [this]() {
+                return !Empty() || status_ >= kShutdown;
+            });
+            consumersWaiting_.fetch_sub(1);
+        }
+    }
+
+    Status try_pop(T &value) {
+        for (;;) {
+            Status status = this->status();
+            if (status == kTerminated) {
+                return kTerminated;
+            }
+            if (TryPop(value)) {
+                WakeProducers();
+                return kOk;
+            }
+            if (!Filling()) {
+                return status == kShutdown ? kShutdown : kEmpty;
+            }
+        }
+    }
+
+    template <class Duration> Status try_pop(T &value, Duration timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (;;) {
+            Status status = this->status();
+            if (status == kTerminated) {
+                return kTerminated;
+            }
+            if (TryPop(value)) {
+                WakeProducers();
+                return kOk;
+            }
+            if (Filling()) {
+                continue;
+            }
+            if (status == kShutdown) {
+                return kShutdown;
+            }
+            std::unique_lock<std::mutex> lck(mtx_);
+            consumersWaiting_.fetch_add(1);
+            bool ready = not_empty_cv_.wait_until(lck, deadline, [this]() {
+                return !Empty() || status_ >= kShutdown;
+            });
+            consumersWaiting_.fetch_sub(1);
+            if (!ready) {
+                return kEmpty;
+            }
+        }
+    }
+
+    /**
+     * Pop up to max values to out, waiting until at least one is there.
+     * popped tells how many were written. Returns kOk if any was popped.
+     */
+    template <typename OutIt>
+    Status pop_bulk(OutIt out, size_t max, size_t *popped) {
+        size_t n = 0;
+        for (;;) {
+            Status status = this->status();
+            if (status == kTerminated) {
+                if (popped) {
+                    *popped = 0;
+                }
+                return kTerminated;
+            }
+            n = TryPopBulk(out, max);
+            if (n) {
+                WakeProducers(n);
+                break;
+            }
+            if (Filling()) {
+                continue;
+            }
+            if (status == kShutdown) {
+                if (popped) {
+                    *popped = 0;
+                }
+                return kShutdown;
+            }
+            std::unique_lock<std::mutex> lck(mtx_);
+            consumersWaiting_.fetch_add(1);
+            not_empty_cv_.wait(lck, [this]() {
+                return !Empty() || status_ >= kShutdown;
+            });
+            consumersWaiting_.fetch_sub(1);
+        }
+        if (popped) {
+            *popped = n;
+        }
+        return kOk;
+    }
+
+    void shutdown() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        status_ = kShutdown;
+        not_empty_cv_.notify_all();
+        not_full_cv_.notify_all();
+    }
+
+    void terminate() {
+        std::lock_guard<std::mutex> lck(mtx_);
+        status_ = kTerminated;
+        not_empty_cv_.notify_all();
+        not_full_cv_.notify_all();
+    }
+
+    // Only a hint while producers or consumers are running.
+    size_t size() const {
+        size_t tail = dequeuePos_.load(std::memory_order_acquire);
+        size_t head = enqueuePos_.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+
+    bool is_empty() const { return size() == 0; }
+
+    Status status() const { return status_.load(std::memory_order_acquire); }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    // Used by the parked side, see WakeConsumers.
+    bool Full() const {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return size() > mask_;
+    }
+
+    bool Empty() const {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return size() == 0;
+    }
+
+    /**
+     * Called when a pop found nothing at the tail. If the positions still
+     * differ a producer claimed the cell there and is filling it, which
+     * takes a moment, so yield instead of parking and try again.
+     */
+    bool Filling() const {
+        if (is_empty()) {
+            return false;
+        }
+        std::this_thread::yield();
+        return true;
+    }
+
+    template <typename Assign> Status PushWait(Assign assign) {
+        for (;;) {
+            Status status = this->status();
+            if (status >= kShutdown) {
+                return status;
+            }
+            if (TryPush(assign)) {
+                WakeConsumers();
+                return kOk;
+            }
+            std::unique_lock<std::mutex> lck(mtx_);
+            producersWaiting_.fetch_add(1);
+            not_full_cv_.wait(lck, [this]() {
+                return !Full() || status_ >= kShutdown;
+            });
+            producersWaiting_.fetch_sub(1);
+        }
+    }
+
+    template <typename Assign> bool TryPush(Assign &assign) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                    assign(cell.value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Full.
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T &value) {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Empty.
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Claim the free cells in a row at the head, fill them from first.
+    template <typename It> size_t TryPushBulk(It &first, It last) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t n = 0;
+            for (It it = first; it != last && n <= mask_; ++it, n++) {
+                const Cell &cell = cells_[(pos + n) & mask_];
+                if (cell.seq.load(std::memory_order_acquire) != pos + n) {
+                    break;
+                }
+            }
+            if (!n) {
+                Cell &cell = cells_[pos & mask_];
+                intptr_t diff = (intptr_t)cell.seq.load(
+                                        std::memory_order_acquire) -
+                                (intptr_t)pos;
+                if (diff < 0) {
+                    return 0; // Full.
+                }
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (enqueuePos_.compare_exchange_weak(
+                        pos, pos + n, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < n; i++, ++first) {
+                    Cell &cell = cells_[(pos + i) & mask_];
+                    cell.value = std::move(*first);
+                    cell.seq.store(pos + i + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    // Claim the filled cells in a row at the tail, up to max.
+    template <typename OutIt> size_t TryPopBulk(OutIt &out, size_t max) {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t n = 0;
+            while (n < max && n <= mask_) {
+                const Cell &cell = cells_[(pos + n) & mask_];
+                if (cell.seq.load(std::memory_order_acquire) != pos + n + 1) {
+                    break;
+                }
+                n++;
+            }
+            if (!n) {
+                Cell &cell = cells_[pos & mask_];
+                intptr_t diff = (intptr_t)cell.seq.load(
+                                        std::memory_order_acquire) -
+                                (intptr_t)(pos + 1);
+                if (diff < 0) {
+                    return 0; // Empty.
+                }
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (dequeuePos_.compare_exchange_weak(
+                        pos, pos + n, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < n; i++) {
+                    Cell &cell = cells_[(pos + i) & mask_];
+                    *out = std::move(cell.value);
+                    ++out;
+                    cell.seq.store(pos + i + mask_ + 1,
+                                   std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    /*
+     * The waiting side increments its counter and then checks the ring
+     * under mtx_, the other side changes the ring and then reads the
+     * counter; the fences make sure one of them sees the other.
+     */
+    void WakeConsumers(size_t n = 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumersWaiting_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lck(mtx_);
+            Notify(not_empty_cv_, n);
+        }
+    }
+
+    void WakeProducers(size_t n = 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producersWaiting_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lck(mtx_);
+            Notify(not_full_cv_, n);
+        }
+    }
+
+    // One waiter per item, they retry and park again if they lost the race.
+    static void Notify(std::condition_variable &cv, size_t n) {
+        if (n == 1) {
+            cv.notify_one();
+        } else {
+            cv.notify_all();
+        }
+    }
+
+    size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> enqueuePos_{0};
+    alignas(64) std::atomic<size_t> dequeuePos_{0};
+
+    alignas(64) std::atomic<Status> status_{kOk};
+    std::atomic<size_t> producersWaiting_{0};
+    std::atomic<size_t> consumersWaiting_{0};
+    std::mutex mtx_;
+    std::condition_variable not_empty_cv_;
+    std::condition_variable not_full_cv_;
+};
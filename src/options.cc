@@ -36,6 +36,13 @@ Options::Options() {
             {"OPTION_DOWNLOAD_SPEED_ENABLE", OTNumber},
             {"OPTION_UPLOAD_SPEED_LIMIT", OTNumber},
             {"OPTION_UPLOAD_SPEED_ENABLE", OTNumber},
+            {"OPTION_UPLOAD_PART_CONCURRENCY", OTNumber},
+            {"OPTION_DOWNLOAD_PART_CONCURRENCY", OTNumber},
+            {"OPTION_ENDPOINT_CONCURRENCY", OTNumber},
+            {"OPTION_THREAD_AUTOTUNE", OTNumber},
+            {"OPTION_THREAD_AUTOTUNE_MAX", OTNumber},
+            {"OPTION_LISTING_CACHE_TTL", OTNumber},
+            {"OPTION_LISTING_CACHE_SIZE", OTNumber},
     };
 
     values_ = {
@@ -51,6 +58,13 @@ Options::Options() {
             0,
             0,
             0,
+            4,
+            4,
+            16,
+            0,
+            16,
+            30,
+            64,
     };
 
     for (size_t i = 0; i < options_.size(); i++) {
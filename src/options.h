@@ -18,6 +18,13 @@ enum Option {
     OPTION_DOWNLOAD_SPEED_ENABLE,
     OPTION_UPLOAD_SPEED_LIMIT,
     OPTION_UPLOAD_SPEED_ENABLE,
+    OPTION_UPLOAD_PART_CONCURRENCY,
+    OPTION_DOWNLOAD_PART_CONCURRENCY,
+    OPTION_ENDPOINT_CONCURRENCY,
+    OPTION_THREAD_AUTOTUNE,
+    OPTION_THREAD_AUTOTUNE_MAX,
+    OPTION_LISTING_CACHE_TTL,
+    OPTION_LISTING_CACHE_SIZE,
 };
 
 enum OptionType {
@@ -1,9 +1,47 @@
 #include "oss_client.h"
+#include "executor_stats.h"
+#include "options.h"
 #include "oss_site_config.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <mutex>
+#include <sstream>
 #include <thread>
 
+/**
+ * Requests in flight to one endpoint, from every pool and thread and from
+ * the coroutines of ossEngine(). Clients of the same endpoint, like those of
+ * two sites in one region, share it.
+ */
+struct EndpointLimiter {
+    // A coroutine waiting for a permit, handed one by the thread releasing.
+    struct Queued {
+        std::coroutine_handle<> handle;
+        OssRequestPermit *permit;
+        LatencyHistogram::Clock::time_point start;
+    };
+
+    std::string endpoint;
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t inFlight{0};
+    // Threads waiting on cv.
+    size_t waiting{0};
+    std::deque<Queued> queued;
+    // Whether the next permit released goes to queued while threads wait
+    // too, alternating so neither kind starves the other.
+    bool preferQueued{false};
+    // From asking for a permit to getting it.
+    LatencyHistogram wait;
+};
+
+std::mutex limitersMtx;
+std::map<std::string, std::unique_ptr<EndpointLimiter>> limiters;
+std::map<const oss::OssClient *, EndpointLimiter *> clientLimiters;
+
+// After the limiters, so they outlive the clients detaching from them.
 std::mutex mtx;
 std::map<std::string, std::map<std::string, std::shared_ptr<oss::OssClient>>>
         clients;
@@ -11,6 +49,180 @@ std::map<std::string, std::map<std::string, std::string>> locations;
 
 const std::string defaultRegion = "oss-cn-hangzhou";
 
+// Set once the clients were disabled, clients made later start disabled.
+bool clientsDisabled = false;
+
+// The limiter of endpoint, made on first use. limitersMtx must be held.
+EndpointLimiter *LimiterOf(const std::string &endpoint) {
+    auto &limiter = limiters[endpoint];
+    if (!limiter) {
+        limiter.reset(new EndpointLimiter);
+        limiter->endpoint = endpoint;
+    }
+    return limiter.get();
+}
+
+void AttachLimiter(const oss::OssClient *client, const std::string &endpoint) {
+    std::lock_guard<std::mutex> lck(limitersMtx);
+    clientLimiters[client] = LimiterOf(endpoint);
+}
+
+// Before the client is deleted, so a later client at its address does not
+// find the entry.
+void DetachLimiter(const oss::OssClient *client) {
+    std::lock_guard<std::mutex> lck(limitersMtx);
+    clientLimiters.erase(client);
+}
+
+size_t EndpointLimit() {
+    return std::max(options().get_int(OPTION_ENDPOINT_CONCURRENCY), 1);
+}
+
+/**
+ * Resume a coroutine handed a permit, in the releasing thread. It only runs
+ * until it sends its request, but when requests fail at once, like after
+ * DisableOssClients, each releases to the next, so they are resumed one
+ * after another instead of nested.
+ */
+void ResumeQueued(std::coroutine_handle<> handle) {
+    thread_local std::deque<std::coroutine_handle<>> *resuming = nullptr;
+    if (resuming) {
+        resuming->push_back(handle);
+        return;
+    }
+    std::deque<std::coroutine_handle<>> handles{handle};
+    resuming = &handles;
+    while (!handles.empty()) {
+        std::coroutine_handle<> next = handles.front();
+        handles.pop_front();
+        next.resume();
+    }
+    resuming = nullptr;
+}
+
+OssRequestPermit::OssRequestPermit(
+        const std::shared_ptr<oss::OssClient> &client) {
+    {
+        std::lock_guard<std::mutex> lck(limitersMtx);
+        auto it = clientLimiters.find(client.get());
+        if (it == clientLimiters.end()) {
+            return;
+        }
+        limiter_ = it->second;
+    }
+    size_t limit = EndpointLimit();
+    auto start = LatencyHistogram::Clock::now();
+    std::unique_lock<std::mutex> lck(limiter_->mtx);
+    limiter_->waiting++;
+    limiter_->cv.wait(lck, [this, limit]() {
+        return limiter_->inFlight < limit;
+    });
+    limiter_->waiting--;
+    limiter_->inFlight++;
+    lck.unlock();
+    limiter_->wait.Record(LatencyHistogram::Clock::now() - start);
+}
+
+OssRequestPermit::~OssRequestPermit() {
+    if (!limiter_) {
+        return;
+    }
+    EndpointLimiter::Queued next{};
+    {
+        std::lock_guard<std::mutex> lck(limiter_->mtx);
+        if (!limiter_->queued.empty() &&
+            (limiter_->waiting == 0 || limiter_->preferQueued)) {
+            // Handed over, it stays in flight.
+            next = limiter_->queued.front();
+            limiter_->queued.pop_front();
+            limiter_->preferQueued = false;
+            next.permit->limiter_ = limiter_;
+        } else {
+            limiter_->inFlight--;
+            limiter_->preferQueued = true;
+            limiter_->cv.notify_one();
+        }
+    }
+    if (next.handle) {
+        limiter_->wait.Record(LatencyHistogram::Clock::now() - next.start);
+        ResumeQueued(next.handle);
+    }
+}
+
+OssRequestPermit::Acquire OssRequestPermit::AcquireFor(
+        const std::string &endpoint) {
+    std::lock_guard<std::mutex> lck(limitersMtx);
+    return Acquire(this, LimiterOf(endpoint));
+}
+
+bool OssRequestPermit::Acquire::await_suspend(std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> lck(limiter_->mtx);
+    if (limiter_->queued.empty() && limiter_->inFlight < EndpointLimit()) {
+        limiter_->inFlight++;
+        permit_->limiter_ = limiter_;
+        limiter_->wait.Record(LatencyHistogram::Clock::duration::zero());
+        return false;
+    }
+    limiter_->queued.push_back(
+            {handle, permit_, LatencyHistogram::Clock::now()});
+    return true;
+}
+
+std::string DumpEndpointStats() {
+    std::ostringstream os;
+    std::lock_guard<std::mutex> lck(limitersMtx);
+    for (const auto &[endpoint, limiter] : limiters) {
+        size_t inFlight, waiting;
+        {
+            std::lock_guard<std::mutex> lck(limiter->mtx);
+            inFlight = limiter->inFlight;
+            waiting = limiter->waiting + limiter->queued.size();
+        }
+        os << endpoint << "\n";
+        os << "  requests: in flight " << inFlight << ", waiting " << waiting
+           << "\n";
+        os << "  permit wait: " << limiter->wait.Summary() << "\n";
+    }
+    return os.str();
+}
+
+std::shared_ptr<oss::OssClient> NewOssClient(const std::string &endpoint,
+                                             const OssSiteNodePtr &node) {
+    oss::ClientConfiguration conf;
+    // Cause speed may be limit to 100KB, and one part/segment is 10M.
+    conf.requestTimeoutMs = 180 * 1000;
+    std::shared_ptr<oss::OssClient> client(
+            new oss::OssClient(endpoint, node->keyId, node->keySecret, conf),
+            [](oss::OssClient *client) {
+                DetachLimiter(client);
+                delete client;
+            });
+    if (clientsDisabled) {
+        client->DisableRequest();
+    }
+    AttachLimiter(client.get(), endpoint);
+    return client;
+}
+
+HttpEngine *ossEngine() {
+    static std::unique_ptr<HttpEngine> engine(new HttpEngine(
+            2, std::max(options().get_int(OPTION_ENDPOINT_CONCURRENCY), 1)));
+    return engine.get();
+}
+
+void DisableOssClients() {
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        clientsDisabled = true;
+        for (auto &[site, clientsOfSite] : clients) {
+            for (auto &[region, client] : clientsOfSite) {
+                client->DisableRequest();
+            }
+        }
+    }
+    ossEngine()->Shutdown();
+}
+
 void SetBucketLocation(const std::string &site,
                        const std::string &bucket,
                        const std::string &location) {
@@ -18,20 +230,37 @@ void SetBucketLocation(const std::string &site,
     locations[site][bucket] = location;
 }
 
+// Called with mtx held by lck, which is released while the location is
+// requested, so a permit waited for does not block every other lookup.
 Status GetBucketLocation(std::string &location,
+                         std::unique_lock<std::mutex> &lck,
                          const std::string &site,
                          const std::shared_ptr<oss::OssClient> &siteClient,
                          const std::string &bucket) {
-    auto &siteBuckets = locations[site];
-    auto it = siteBuckets.find(bucket);
-    if (it != siteBuckets.end()) {
-        location = it->second;
-        return Status::OK();
+    {
+        auto &siteBuckets = locations[site];
+        auto it = siteBuckets.find(bucket);
+        if (it != siteBuckets.end()) {
+            location = it->second;
+            return Status::OK();
+        }
     }
-    auto outcome = siteClient->GetBucketLocation(bucket);
-    if (outcome.isSuccess()) {
-        const std::string &result = outcome.result().Location();
-        siteBuckets[bucket] = result;
+
+    lck.unlock();
+    std::string result;
+    bool success;
+    {
+        OssRequestPermit permit(siteClient);
+        auto outcome = siteClient->GetBucketLocation(bucket);
+        success = outcome.isSuccess();
+        if (success) {
+            result = outcome.result().Location();
+        }
+    }
+    lck.lock();
+
+    if (success) {
+        locations[site][bucket] = result;
         location = result;
         return Status::OK();
     }
@@ -54,11 +283,8 @@ Status getOssSiteClients(
                                             ? defaultRegion
                                             : ossSiteNode->region;
         std::string endpoint = region + ".aliyuncs.com";
-        oss::ClientConfiguration conf;
-        // Cause speed may be limit to 100KB, and one part/segment is 10M.
-        conf.requestTimeoutMs = 180 * 1000;
-        std::shared_ptr<oss::OssClient> client(new oss::OssClient(
-                endpoint, ossSiteNode->keyId, ossSiteNode->keySecret, conf));
+        std::shared_ptr<oss::OssClient> client =
+                NewOssClient(endpoint, ossSiteNode);
         clientsOfSite[""] = client;
         clientsOfSite[region] = client;
         clients[site] = clientsOfSite;
@@ -70,7 +296,7 @@ Status getOssSiteClients(
 Status getOssClient(std::shared_ptr<oss::OssClient> &ossClient,
                     const std::string &site,
                     const std::string &bucket) {
-    std::lock_guard<std::mutex> lck(mtx);
+    std::unique_lock<std::mutex> lck(mtx);
     Status status;
 
     std::map<std::string, std::shared_ptr<oss::OssClient>> clientsOfSite;
@@ -84,11 +310,13 @@ Status getOssClient(std::shared_ptr<oss::OssClient> &ossClient,
     }
 
     std::string location;
-    status = GetBucketLocation(location, site, siteClient, bucket);
+    status = GetBucketLocation(location, lck, site, siteClient, bucket);
     RETURN_IF_FAIL(status);
 
-    auto it = clientsOfSite.find(location);
-    if (it != clientsOfSite.end()) {
+    // Looked up again, another thread may have added it while unlocked.
+    auto &siteClients = clients[site];
+    auto it = siteClients.find(location);
+    if (it != siteClients.end()) {
         ossClient = it->second;
         return Status::OK();
     }
@@ -99,12 +327,9 @@ Status getOssClient(std::shared_ptr<oss::OssClient> &ossClient,
     }
 
     std::string endpoint = location + ".aliyuncs.com";
-    oss::ClientConfiguration conf;
-    // Cause speed may be limit to 100KB, and one part/segment is 10M.
-    conf.requestTimeoutMs = 180 * 1000;
-    std::shared_ptr<oss::OssClient> bucketClient(new oss::OssClient(
-            endpoint, ossSiteNode->keyId, ossSiteNode->keySecret, conf));
-    clientsOfSite[location] = bucketClient;
+    std::shared_ptr<oss::OssClient> bucketClient =
+            NewOssClient(endpoint, ossSiteNode);
+    siteClients[location] = bucketClient;
     ossClient = bucketClient;
 
     return Status::OK();
@@ -132,13 +357,35 @@ Status getOssClientByRegion(std::shared_ptr<oss::OssClient> &ossClient,
     }
 
     std::string endpoint = region + ".aliyuncs.com";
-    oss::ClientConfiguration conf;
-    // Cause speed may be limit to 100KB, and one part/segment is 10M.
-    conf.requestTimeoutMs = 180 * 1000;
-    std::shared_ptr<oss::OssClient> bucketClient(new oss::OssClient(
-            endpoint, ossSiteNode->keyId, ossSiteNode->keySecret, conf));
-    clientsOfSite[region] = bucketClient;
+    std::shared_ptr<oss::OssClient> bucketClient =
+            NewOssClient(endpoint, ossSiteNode);
+    clients[site][region] = bucketClient;
     ossClient = bucketClient;
 
     return Status::OK();
 }
+
+Status getOssEndpoint(OssEndpoint &endpoint,
+                      const std::string &site,
+                      const std::string &bucket) {
+    std::unique_lock<std::mutex> lck(mtx);
+    Status status;
+
+    std::map<std::string, std::shared_ptr<oss::OssClient>> clientsOfSite;
+    status = getOssSiteClients(clientsOfSite, site);
+    RETURN_IF_FAIL(status);
+
+    std::string location;
+    status = GetBucketLocation(
+            location, lck, site, clientsOfSite[""], bucket);
+    RETURN_IF_FAIL(status);
+
+    OssSiteNodePtr ossSiteNode = ossSiteConfig()->get(site);
+    if (!ossSiteNode) {
+        return Status(EC_FAIL, "");
+    }
+    endpoint.host = location + ".aliyuncs.com";
+    endpoint.keyId = ossSiteNode->keyId;
+    endpoint.keySecret = ossSiteNode->keySecret;
+    return Status::OK();
+}
@@ -1,8 +1,12 @@
 #pragma once
 
+#include "http_engine.h"
+#include "oss_request.h"
 #include "status.h"
 #include <alibabacloud/oss/OssClient.h>
 
+#include <coroutine>
+
 namespace oss = AlibabaCloud::OSS;
 
 #define OSSPROTOP "oss://"
@@ -16,6 +20,72 @@ Status getOssClientByRegion(std::shared_ptr<oss::OssClient> &ossClient,
                             const std::string &site,
                             const std::string &region);
 
+// The endpoint and keys for requests to bucket of site, through ossEngine().
+Status getOssEndpoint(OssEndpoint &endpoint,
+                      const std::string &site,
+                      const std::string &bucket);
+
+/**
+ * Drives the asynchronous requests of every site, allowing each loop its
+ * share of OPTION_ENDPOINT_CONCURRENCY connections to one endpoint. Its
+ * requests hold an OssRequestPermit too, so they count against the same
+ * limit as those of the clients.
+ */
+HttpEngine *ossEngine();
+
+/**
+ * Held around every request. Waits while the endpoint of the client already
+ * has OPTION_ENDPOINT_CONCURRENCY requests in flight, whichever pool, thread
+ * or coroutine sent them, so parallel schedules do not trip the throttling
+ * of a regional endpoint.
+ */
+class OssRequestPermit {
+public:
+    explicit OssRequestPermit(const std::shared_ptr<oss::OssClient> &client);
+    // Holds no permit until AcquireFor is awaited.
+    OssRequestPermit() = default;
+    ~OssRequestPermit();
+
+    OssRequestPermit(const OssRequestPermit &) = delete;
+    OssRequestPermit &operator=(const OssRequestPermit &) = delete;
+
+    class Acquire {
+    public:
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        void await_resume() const noexcept {}
+
+    private:
+        friend class OssRequestPermit;
+
+        Acquire(OssRequestPermit *permit, struct EndpointLimiter *limiter)
+            : permit_(permit), limiter_(limiter) {}
+
+        OssRequestPermit *permit_;
+        struct EndpointLimiter *limiter_;
+    };
+
+    /**
+     * Awaitable taking the permit for a request of ossEngine() to endpoint,
+     * the host of an OssEndpoint. A coroutine waiting is resumed in the
+     * thread releasing a permit, and should only send its request then.
+     */
+    Acquire AcquireFor(const std::string &endpoint);
+
+private:
+    struct EndpointLimiter *limiter_{};
+};
+
+// Requests in flight and waiting, and the permit wait, per endpoint.
+std::string DumpEndpointStats();
+
+/**
+ * Abort the requests in flight on every client and ossEngine() and fail
+ * later ones, so worker threads blocked in the SDK and coroutines awaiting
+ * requests return when the application closes.
+ */
+void DisableOssClients();
+
 void SetBucketLocation(const std::string &site,
                        const std::string &bucket,
                        const std::string &location);
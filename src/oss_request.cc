@@ -0,0 +1,321 @@
+#include "oss_request.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+const char *const kWeekdays[] = {"Sun", "Mon", "Tue", "Wed",
+                                 "Thu", "Fri", "Sat"};
+const char *const kMonths[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+// Query parameters which are part of the signed resource.
+const char *const kSubResources[] = {
+        "acl",      "append",   "cors",       "delete",  "lifecycle",
+        "location", "logging",  "partNumber", "position", "referer",
+        "restore",  "symlink",  "tagging",    "uploadId", "uploads",
+        "versionId", "website",
+};
+
+// RFC 1123 in GMT, spelled out since strftime follows the locale.
+std::string HttpDate(std::time_t now) {
+    std::tm tm;
+    gmtime_r(&now, &tm);
+    char buf[64];
+    snprintf(buf,
+             sizeof(buf),
+             "%s, %02d %s %04d %02d:%02d:%02d GMT",
+             kWeekdays[tm.tm_wday],
+             tm.tm_mday,
+             kMonths[tm.tm_mon],
+             tm.tm_year + 1900,
+             tm.tm_hour,
+             tm.tm_min,
+             tm.tm_sec);
+    return buf;
+}
+
+std::string UrlEncode(const std::string &s, bool keepSlash) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    out.reserve(s.size());
+    for (unsigned char c : s) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' ||
+            c == '~' || (c == '/' && keepSlash)) {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+    return out;
+}
+
+std::string ToLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](char c) {
+        return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+    });
+    return s;
+}
+
+std::string Trim(const std::string &s) {
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+std::string XmlUnescape(const std::string &s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] != '&') {
+            out += s[i];
+            continue;
+        }
+        size_t semi = s.find(';', i);
+        if (semi == std::string::npos) {
+            out += s[i];
+            continue;
+        }
+        std::string entity = s.substr(i + 1, semi - i - 1);
+        if (entity == "amp") {
+            out += '&';
+        } else if (entity == "lt") {
+            out += '<';
+        } else if (entity == "gt") {
+            out += '>';
+        } else if (entity == "quot") {
+            out += '"';
+        } else if (entity == "apos") {
+            out += '\'';
+        } else if (!entity.empty() && entity[0] == '#') {
+            unsigned long code =
+                    entity.size() > 1 && entity[1] == 'x'
+                            ? strtoul(entity.c_str() + 2, nullptr, 16)
+                            : strtoul(entity.c_str() + 1, nullptr, 10);
+            // Encode as UTF-8.
+            if (code < 0x80) {
+                out += char(code);
+            } else if (code < 0x800) {
+                out += char(0xC0 | (code >> 6));
+                out += char(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                out += char(0xE0 | (code >> 12));
+                out += char(0x80 | ((code >> 6) & 0x3F));
+                out += char(0x80 | (code & 0x3F));
+            } else {
+                out += char(0xF0 | (code >> 18));
+                out += char(0x80 | ((code >> 12) & 0x3F));
+                out += char(0x80 | ((code >> 6) & 0x3F));
+                out += char(0x80 | (code & 0x3F));
+            }
+        } else {
+            out += s.substr(i, semi - i + 1);
+        }
+        i = semi;
+    }
+    return out;
+}
+
+/**
+ * Find the next <tag> element of xml from pos and store its raw content,
+ * then move pos past it. The results of OSS have no attributes and no
+ * nesting of an element in itself, which is all this handles.
+ */
+bool NextElement(const std::string &xml,
+                 const std::string &tag,
+                 size_t &pos,
+                 std::string &content) {
+    std::string open = "<" + tag + ">";
+    size_t begin = xml.find(open, pos);
+    if (begin == std::string::npos) {
+        return false;
+    }
+    begin += open.size();
+    size_t end = xml.find("</" + tag + ">", begin);
+    if (end == std::string::npos) {
+        return false;
+    }
+    content = xml.substr(begin, end - begin);
+    pos = end + tag.size() + 3;
+    return true;
+}
+
+std::string ElementText(const std::string &xml, const std::string &tag) {
+    size_t pos = 0;
+    std::string content;
+    if (NextElement(xml, tag, pos, content)) {
+        return XmlUnescape(content);
+    }
+    return "";
+}
+} // namespace
+
+std::string OssSignature(const std::string &keySecret,
+                         const std::string &stringToSign) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestSize = 0;
+    HMAC(EVP_sha1(),
+         keySecret.data(),
+         int(keySecret.size()),
+         reinterpret_cast<const unsigned char *>(stringToSign.data()),
+         stringToSign.size(),
+         digest,
+         &digestSize);
+    unsigned char encoded[4 * ((EVP_MAX_MD_SIZE + 2) / 3) + 1];
+    int n = EVP_EncodeBlock(encoded, digest, int(digestSize));
+    return std::string(reinterpret_cast<char *>(encoded), n);
+}
+
+void SignOssRequest(HttpRequest &request,
+                    const OssEndpoint &endpoint,
+                    const std::string &bucket,
+                    const std::string &key,
+                    const std::map<std::string, std::string> &query) {
+    request.url = endpoint.scheme + "://" + bucket + "." + endpoint.host +
+                  "/" + UrlEncode(key, true);
+    std::string resource = "/" + bucket + "/" + key;
+    char separator = '?';
+    for (const auto &[name, value] : query) {
+        request.url += separator + UrlEncode(name, false);
+        if (!value.empty()) {
+            request.url += "=" + UrlEncode(value, false);
+        }
+        separator = '&';
+    }
+    // std::map keeps the sub resources sorted, as the signature needs.
+    separator = '?';
+    for (const auto &[name, value] : query) {
+        if (std::find_if(std::begin(kSubResources),
+                         std::end(kSubResources),
+                         [&name = name](const char *s) {
+                             return name == s;
+                         }) == std::end(kSubResources)) {
+            continue;
+        }
+        resource += separator + name;
+        if (!value.empty()) {
+            resource += "=" + value;
+        }
+        separator = '&';
+    }
+    request.connectTo = endpoint.connectTo;
+
+    std::string date = HttpDate(std::time(nullptr));
+    request.headers.push_back("Date: " + date);
+
+    std::string contentMd5, contentType;
+    std::map<std::string, std::string> ossHeaders;
+    for (const auto &header : request.headers) {
+        size_t colon = header.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = ToLower(Trim(header.substr(0, colon)));
+        std::string value = Trim(header.substr(colon + 1));
+        if (name == "content-md5") {
+            contentMd5 = value;
+        } else if (name == "content-type") {
+            contentType = value;
+        } else if (name.compare(0, 6, "x-oss-") == 0) {
+            ossHeaders[name] = value;
+        }
+    }
+    std::string stringToSign = request.method + "\n" + contentMd5 + "\n" +
+                               contentType + "\n" + date + "\n";
+    for (const auto &[name, value] : ossHeaders) {
+        stringToSign += name + ":" + value + "\n";
+    }
+    stringToSign += resource;
+    request.headers.push_back(
+            "Authorization: OSS " + endpoint.keyId + ":" +
+            OssSignature(endpoint.keySecret, stringToSign));
+}
+
+std::string OssErrorMessage(const HttpResponse &response) {
+    if (response.code == 0) {
+        return response.error;
+    }
+    std::string code = ElementText(response.body, "Code");
+    if (code.empty()) {
+        return "HTTP " + std::to_string(response.code);
+    }
+    return code + ": " + ElementText(response.body, "Message");
+}
+
+bool ParseOssListPage(const std::string &xml, OssListPage &page) {
+    if (xml.find("<ListBucketResult") == std::string::npos) {
+        return false;
+    }
+    size_t pos = 0;
+    std::string content;
+    while (NextElement(xml, "CommonPrefixes", pos, content)) {
+        page.prefixes.push_back(ElementText(content, "Prefix"));
+    }
+    pos = 0;
+    while (NextElement(xml, "Contents", pos, content)) {
+        OssListPage::Object object;
+        object.key = ElementText(content, "Key");
+        object.size = strtoull(ElementText(content, "Size").c_str(), nullptr, 10);
+        object.lastModified = ElementText(content, "LastModified");
+        object.etag = ElementText(content, "ETag");
+        // Quoted like the header, which the SDK strips as well.
+        if (object.etag.size() >= 2 && object.etag.front() == '"' &&
+            object.etag.back() == '"') {
+            object.etag = object.etag.substr(1, object.etag.size() - 2);
+        }
+        page.objects.push_back(std::move(object));
+    }
+    page.truncated = ElementText(xml, "IsTruncated") == "true";
+    page.nextMarker = ElementText(xml, "NextMarker");
+    return true;
+}
+
+std::time_t ParseOssTime(const std::string &time, bool http) {
+    std::tm tm{};
+    if (http) {
+        char month[4] = {};
+        if (sscanf(time.c_str(),
+                   "%*3s, %d %3s %d %d:%d:%d",
+                   &tm.tm_mday,
+                   month,
+                   &tm.tm_year,
+                   &tm.tm_hour,
+                   &tm.tm_min,
+                   &tm.tm_sec) != 6) {
+            return 0;
+        }
+        auto it = std::find_if(std::begin(kMonths),
+                               std::end(kMonths),
+                               [&month](const char *m) {
+                                   return strcmp(m, month) == 0;
+                               });
+        if (it == std::end(kMonths)) {
+            return 0;
+        }
+        tm.tm_mon = int(it - std::begin(kMonths));
+    } else {
+        if (sscanf(time.c_str(),
+                   "%d-%d-%dT%d:%d:%d",
+                   &tm.tm_year,
+                   &tm.tm_mon,
+                   &tm.tm_mday,
+                   &tm.tm_hour,
+                   &tm.tm_min,
+                   &tm.tm_sec) != 6) {
+            return 0;
+        }
+        tm.tm_mon -= 1;
+    }
+    tm.tm_year -= 1900;
+    return timegm(&tm);
+}
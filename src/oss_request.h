@@ -0,0 +1,56 @@
+#pragma once
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "http_engine.h"
+
+// Where and as whom requests for the buckets of one region are sent.
+struct OssEndpoint {
+    // Like oss-cn-hangzhou.aliyuncs.com, buckets are its subdomains.
+    std::string host;
+    std::string keyId;
+    std::string keySecret;
+    std::string scheme{"https"};
+    // host:port to connect to instead, for a local stand-in.
+    std::string connectTo;
+};
+
+/**
+ * Set the url of request to key of bucket with the query parameters, and
+ * sign it with the headers it already has. Sign last, once every x-oss-*
+ * header was added.
+ */
+void SignOssRequest(HttpRequest &request,
+                    const OssEndpoint &endpoint,
+                    const std::string &bucket,
+                    const std::string &key,
+                    const std::map<std::string, std::string> &query = {});
+
+// Signature of the version 1 scheme, base64 of the HMAC-SHA1 of stringToSign.
+std::string OssSignature(const std::string &keySecret,
+                         const std::string &stringToSign);
+
+// The Code and Message of an OSS error, or why the transfer failed.
+std::string OssErrorMessage(const HttpResponse &response);
+
+struct OssListPage {
+    struct Object {
+        std::string key;
+        size_t size{0};
+        std::string lastModified;
+        std::string etag;
+    };
+    std::vector<std::string> prefixes;
+    std::vector<Object> objects;
+    bool truncated{false};
+    std::string nextMarker;
+};
+
+// Parse the result of ListObjects, returns false if xml is not one.
+bool ParseOssListPage(const std::string &xml, OssListPage &page);
+
+// Parse 2006-01-02T15:04:05.000Z, or an HTTP date when http is set.
+std::time_t ParseOssTime(const std::string &time, bool http = false);
@@ -1,15 +1,133 @@
 #include "oss_site.h"
+#include "hash_service.h"
 #include "local_site.h"
 #include "options.h"
 #include "oss_client.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <cassert>
+#include <cerrno>
 #include <ctime>
 #include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
 
+namespace {
+/**
+ * Output stream which writes to a file descriptor with pwrite, so several
+ * ranges of one file can be downloaded at the same time. Writes fail once
+ * token is cancelled, which makes the SDK abort the download.
+ */
+class PositionalWriteBuf : public std::streambuf {
+public:
+    PositionalWriteBuf(int fd, size_t position, const CancellationToken &token)
+        : fd_(fd), position_(position), token_(token) {
+        setp(buf_, buf_ + sizeof(buf_));
+    }
+
+    ~PositionalWriteBuf() { sync(); }
+
+    size_t written() const { return written_; }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (Flush() != 0) {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    int sync() override { return Flush(); }
+
+    pos_type seekoff(off_type off,
+                     std::ios_base::seekdir dir,
+                     std::ios_base::openmode which) override {
+        if (off == 0 && dir == std::ios_base::cur &&
+            (which & std::ios_base::out)) {
+            return pos_type(written_ + (pptr() - pbase()));
+        }
+        return pos_type(off_type(-1));
+    }
+
+private:
+    int Flush() {
+        if (token_.cancelled()) {
+            return -1;
+        }
+        const char *p = pbase();
+        size_t n = pptr() - pbase();
+        while (n > 0) {
+            ssize_t w = ::pwrite(fd_, p, n, position_ + written_);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            p += w;
+            n -= w;
+            written_ += w;
+        }
+        setp(buf_, buf_ + sizeof(buf_));
+        return 0;
+    }
+
+    int fd_;
+    size_t position_;
+    CancellationToken token_;
+    size_t written_{0};
+    char buf_[64 * 1024];
+};
+
+class PositionalWriteStream : public std::iostream {
+public:
+    PositionalWriteStream(int fd,
+                          size_t position,
+                          const CancellationToken &token)
+        : std::iostream(nullptr), buf_(fd, position, token) {
+        rdbuf(&buf_);
+    }
+
+    size_t written() const { return buf_.written(); }
+
+private:
+    PositionalWriteBuf buf_;
+};
+
+// Closes the file it opened when it goes away.
+struct ScopedFd {
+    explicit ScopedFd(const std::string &path)
+        : fd(::open(path.c_str(), O_RDONLY)) {}
+
+    ~ScopedFd() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    int fd;
+};
+
+void AddTrafficLimit(HttpRequest &request, bool upload) {
+    bool enable = options().get_bool(upload ? OPTION_UPLOAD_SPEED_ENABLE
+                                            : OPTION_DOWNLOAD_SPEED_ENABLE);
+    int limit = options().get_int(upload ? OPTION_UPLOAD_SPEED_LIMIT
+                                         : OPTION_DOWNLOAD_SPEED_LIMIT);
+    if (enable && limit > 0) {
+        request.headers.push_back("x-oss-traffic-limit: " +
+                                  std::to_string(limit * 1024 * 8));
+    }
+}
+} // namespace
+
 OssSite::OssSite(const std::string &name) : Site(STOss), name_(name) {
 }
 
@@ -25,6 +143,17 @@ Status OssSite::GetDir(const std::string &path, DirPtr &dir) {
     }
 }
 
+Status OssSite::GetDirInPages(const std::string &path,
+                              DirPtr &dir,
+                              const ListPageCallback &onPage,
+                              const CancellationToken &token) {
+    if (path == OSSPROTOP) {
+        return ListBuckets(dir);
+    } else {
+        return ListObjects(path, dir, onPage, token);
+    }
+}
+
 Status OssSite::MakeDir(const std::string &path) {
     auto [bucket, pathPart] = SplitPath(path);
 
@@ -38,6 +167,7 @@ Status OssSite::MakeDir(const std::string &path) {
     }
     std::shared_ptr<std::iostream> content =
             std::make_shared<std::stringstream>();
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->PutObject(bucket, pathPart, content);
     if (outcome.isSuccess()) {
         return Status::OK();
@@ -74,6 +204,7 @@ Status OssSite::Remove(const std::shared_ptr<oss::OssClient> &ossClient,
     auto [bucket, name] = SplitPath(path);
 
     oss::DeleteObjectRequest delRequest(bucket, name);
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->DeleteObject(delRequest);
     if (outcome.isSuccess()) {
         return Status::OK();
@@ -90,6 +221,7 @@ Status OssSite::CreateBucket(const std::string &name,
     RETURN_IF_FAIL(status);
 
     oss::CreateBucketRequest request(name, storageClass, acl);
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->CreateBucket(request);
     if (outcome.isSuccess()) {
         return Status::OK();
@@ -102,6 +234,7 @@ Status OssSite::RemoveBucket(const std::string &name) {
     Status status = getOssClient(ossClient, name_, name);
     RETURN_IF_FAIL(status);
 
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->DeleteBucket(name);
     if (outcome.isSuccess()) {
         return Status::OK();
@@ -134,6 +267,7 @@ std::string OssSite::GetETag(const std::string &path) const {
     if (!status.ok()) {
         return "";
     }
+    OssRequestPermit permit(ossClient);
     auto header = ossClient->HeadObject(bucket, name);
     if (header.isSuccess()) {
         auto &objectMetaData = header.result();
@@ -164,6 +298,7 @@ Status OssSite::ListBuckets(DirPtr &dir) {
     RETURN_IF_FAIL(status);
 
     oss::ListBucketsRequest request;
+    OssRequestPermit permit(ossClient);
     oss::ListBucketsOutcome outcome = ossClient->ListBuckets(request);
     if (outcome.isSuccess()) {
         dir.reset(new Dir{OSSPROTOP});
@@ -188,7 +323,10 @@ Status OssSite::ListBuckets(DirPtr &dir) {
     }
 }
 
-Status OssSite::ListObjects(const std::string &path, DirPtr &dir) {
+Status OssSite::ListObjects(const std::string &path,
+                            DirPtr &dir,
+                            const ListPageCallback &onPage,
+                            const CancellationToken &token) {
     dir.reset(new Dir{path});
     dir->tag = OssFilesTag;
     if (dir->path.back() != '/') {
@@ -208,17 +346,21 @@ Status OssSite::ListObjects(const std::string &path, DirPtr &dir) {
 
     bool isTruncated = false;
     std::string nextMarker = "";
+    size_t from = 0;
     do {
+        if (token.cancelled()) {
+            return Status(EC_FAIL, "cancelled");
+        }
         oss::ListObjectsRequest request(bucket);
         request.setPrefix(prefix);
         request.setDelimiter("/");
         request.setMaxKeys(640);
         request.setMarker(nextMarker);
+        OssRequestPermit permit(ossClient);
         oss::ListObjectOutcome outcome = ossClient->ListObjects(request);
         if (outcome.isSuccess()) {
             for (const auto &p : outcome.result().CommonPrefixes()) {
                 FilePtr file(new File);
-                file->cmp = CSNone;
                 file->type = FTDirectory;
                 file->name =
                         p.substr(prefix.size(), p.size() - prefix.size() - 1);
@@ -229,7 +371,6 @@ Status OssSite::ListObjects(const std::string &path, DirPtr &dir) {
             for (const auto &o : outcome.result().ObjectSummarys()) {
                 if (o.Key() != prefix) {
                     FilePtr file(new File);
-                    file->cmp = CSNone;
                     file->type = FTFile;
                     const auto &key = o.Key();
                     file->name = key.substr(prefix.size(),
@@ -241,6 +382,8 @@ Status OssSite::ListObjects(const std::string &path, DirPtr &dir) {
                     file->stat.lastModifiedTime = timegm(&tm);
                     if (o.ETag().size() == 32) {
                         file->stat.etag = o.ETag();
+                    } else if (o.ETag().find('-') != std::string::npos) {
+                        file->stat.partETag = o.ETag();
                     }
                     dir->files.push_back(file);
                     dir->fileCount++;
@@ -249,8 +392,14 @@ Status OssSite::ListObjects(const std::string &path, DirPtr &dir) {
             }
             isTruncated = outcome.result().IsTruncated();
             nextMarker = outcome.result().NextMarker();
+            if (isTruncated && onPage) {
+                onPage(*dir, from);
+                from = dir->files.size();
+            }
         } else {
-            break;
+            // The pages so far are not the directory, fail rather than show
+            // or cache them as if complete.
+            return Status(EC_FAIL, outcome.error().Message());
         }
     } while (isTruncated);
 
@@ -284,6 +433,7 @@ Status OssSite::CopyFileFromLocal(const std::string &srcPath,
     if (uploadSpeedEnable && uploadSpeedLimit > 0) {
         request.setTrafficLimit(uploadSpeedLimit * 1024 * 8);
     }
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->PutObject(request);
     if (outcome.isSuccess()) {
         return Status::OK();
@@ -316,6 +466,7 @@ Status OssSite::CopyFileToLocal(const std::string &srcPath,
                                                std::ios_base::trunc |
                                                std::ios_base::binary));
     });
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->GetObject(request);
     if (outcome.isSuccess()) {
         if (stat.lastModifiedTime) {
@@ -342,7 +493,8 @@ Status OssSite::InitMultipartUpload(const std::string &srcPath,
     oss::InitiateMultipartUploadRequest multipartUploadRequest(bucket,
                                                                pathPart);
     multipartUploadRequest.MetaData().UserMetaData()["userETag"] =
-            LocalSite::GetETagStatic(srcPath);
+            hashService()->ContentETag(srcPath, Executor::kBulk).get();
+    OssRequestPermit permit(ossClient);
     auto multipartUploadResult =
             ossClient->InitiateMultipartUpload(multipartUploadRequest);
     if (multipartUploadResult.isSuccess()) {
@@ -378,6 +530,7 @@ Status OssSite::CopyFileFromLocalPart(const std::string &srcPath,
     uploadPartRequest.setContentLength(size);
     uploadPartRequest.setUploadId(uploadId);
     uploadPartRequest.setPartNumber(partId);
+    OssRequestPermit permit(ossClient);
     auto uploadPartOutcome = ossClient->UploadPart(uploadPartRequest);
     if (uploadPartOutcome.isSuccess()) {
         return Status::OK();
@@ -388,7 +541,9 @@ Status OssSite::CopyFileFromLocalPart(const std::string &srcPath,
     return Status(EC_FAIL, "");
 }
 
-Status OssSite::CopyFileFromLocalPartFinish(const std::string &dstPath,
+Status OssSite::CopyFileFromLocalPartFinish(const std::string &srcPath,
+                                            const FileStat &srcStat,
+                                            const std::string &dstPath,
                                             const std::string &uploadId) {
     auto [bucket, path] = SplitPath(dstPath);
 
@@ -400,6 +555,7 @@ Status OssSite::CopyFileFromLocalPartFinish(const std::string &dstPath,
     oss::ListPartsRequest listuploadrequest(bucket, path);
     listuploadrequest.setUploadId(uploadId);
     for (;;) {
+        OssRequestPermit permit(ossClient);
         auto listUploadResult = ossClient->ListParts(listuploadrequest);
         if (listUploadResult.isSuccess()) {
             partList.insert(partList.end(),
@@ -418,8 +574,16 @@ Status OssSite::CopyFileFromLocalPartFinish(const std::string &dstPath,
     request.setUploadId(uploadId);
     request.setPartList(partList);
 
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->CompleteMultipartUpload(request);
     if (outcome.isSuccess()) {
+        std::vector<std::string> partETags;
+        partETags.reserve(partList.size());
+        for (const auto &part : partList) {
+            partETags.push_back(part.ETag());
+        }
+        hashService()->CachePartETag(
+                srcPath, srcStat, partETags, outcome.result().ETag());
         return Status::OK();
     }
     return Status(EC_FAIL, "");
@@ -439,6 +603,7 @@ Status OssSite::CopyFileFromLocalPartAbort(const std::string &bucket,
     } else {
         oss::ListMultipartUploadsRequest listMultiUploadRequest(bucket);
         for (;;) {
+            OssRequestPermit permit(ossClient);
             auto listResult =
                     ossClient->ListMultipartUploads(listMultiUploadRequest);
             if (listResult.isSuccess()) {
@@ -464,6 +629,7 @@ Status OssSite::CopyFileFromLocalPartAbort(const std::string &bucket,
     for (auto &[path, uploadId] : uploads) {
         oss::AbortMultipartUploadRequest abortUploadRequest(
                 bucket, path, uploadId);
+        OssRequestPermit permit(ossClient);
         auto abortUploadIdResult =
                 ossClient->AbortMultipartUpload(abortUploadRequest);
         if (!abortUploadIdResult.isSuccess()) {
@@ -473,10 +639,12 @@ Status OssSite::CopyFileFromLocalPartAbort(const std::string &bucket,
     return Status::OK();
 }
 
-Status OssSite::CopyFileToLocalPart(std::shared_ptr<std::fstream> &out,
+Status OssSite::CopyFileToLocalPart(int fd,
+                                    size_t position,
                                     const std::string &srcPath,
                                     size_t begin,
-                                    size_t end) {
+                                    size_t end,
+                                    const CancellationToken &token) {
     auto [bucket, path] = OssSite::SplitPath(srcPath);
 
     std::shared_ptr<oss::OssClient> ossClient;
@@ -490,11 +658,235 @@ Status OssSite::CopyFileToLocalPart(std::shared_ptr<std::fstream> &out,
         request.setTrafficLimit(downloadSpeedLimit * 1024 * 8);
     }
     request.setRange(begin, end);
+    auto out = std::make_shared<PositionalWriteStream>(fd, position, token);
     request.setResponseStreamFactory([&out]() { return out; });
+    OssRequestPermit permit(ossClient);
     auto outcome = ossClient->GetObject(request);
-    if (outcome.isSuccess()) {
+    out->flush();
+    if (outcome.isSuccess() && out->good() &&
+        out->written() == end - begin + 1) {
         return Status::OK();
     } else {
         return Status(EC_FAIL, "");
     }
 }
+
+AsyncTask<Status> OssSite::ListObjectsAsync(std::string path, DirPtr &dir) {
+    dir.reset(new Dir{path});
+    dir->tag = OssFilesTag;
+    if (dir->path.back() != '/') {
+        dir->path += "/";
+    }
+
+    FilePtr parent(new File);
+    parent->name = "..";
+    parent->type = FTDirectory;
+    dir->files.push_back(parent);
+
+    auto [bucket, prefix] = SplitPath(dir->path);
+
+    OssEndpoint endpoint;
+    Status status = getOssEndpoint(endpoint, name_, bucket);
+    if (!status.ok()) {
+        co_return status;
+    }
+
+    OssListPage page;
+    do {
+        std::map<std::string, std::string> query{{"delimiter", "/"},
+                                                 {"max-keys", "640"}};
+        if (!prefix.empty()) {
+            query["prefix"] = prefix;
+        }
+        if (!page.nextMarker.empty()) {
+            query["marker"] = page.nextMarker;
+        }
+        OssRequestPermit permit;
+        co_await permit.AcquireFor(endpoint.host);
+        HttpRequest request;
+        SignOssRequest(request, endpoint, bucket, "", query);
+        HttpResponse response;
+        co_await ossEngine()->Perform(request, response);
+        page = OssListPage();
+        if (response.code != 200 || !ParseOssListPage(response.body, page)) {
+            co_return Status(EC_FAIL, OssErrorMessage(response));
+        }
+        for (const auto &p : page.prefixes) {
+            FilePtr file(new File);
+            file->type = FTDirectory;
+            file->name = p.substr(prefix.size(), p.size() - prefix.size() - 1);
+            file->stat.lastModifiedTime = 0;
+            dir->files.push_back(file);
+            dir->dirCount++;
+        }
+        for (const auto &o : page.objects) {
+            if (o.key != prefix) {
+                FilePtr file(new File);
+                file->type = FTFile;
+                file->name = o.key.substr(prefix.size());
+                file->stat.size = o.size;
+                file->stat.lastModifiedTime = ParseOssTime(o.lastModified);
+                if (o.etag.size() == 32) {
+                    file->stat.etag = o.etag;
+                } else if (o.etag.find('-') != std::string::npos) {
+                    file->stat.partETag = o.etag;
+                }
+                dir->files.push_back(file);
+                dir->fileCount++;
+                dir->totalSize += file->stat.size;
+            }
+        }
+    } while (page.truncated);
+
+    co_return Status::OK();
+}
+
+AsyncTask<Status> OssSite::CopyFileFromLocalAsync(std::string srcPath,
+                                                  std::string dstPath) {
+    auto [bucket, path] = SplitPath(dstPath);
+
+    OssEndpoint endpoint;
+    Status status = getOssEndpoint(endpoint, name_, bucket);
+    if (!status.ok()) {
+        co_return status;
+    }
+
+    ScopedFd file(srcPath);
+    struct stat st;
+    if (file.fd < 0 || fstat(file.fd, &st) != 0) {
+        co_return Status(EC_FAIL, "");
+    }
+    OssRequestPermit permit;
+    co_await permit.AcquireFor(endpoint.host);
+    HttpRequest request;
+    request.method = "PUT";
+    request.bodyFd = file.fd;
+    request.bodySize = st.st_size;
+    AddTrafficLimit(request, true);
+    SignOssRequest(request, endpoint, bucket, path);
+    HttpResponse response;
+    co_await ossEngine()->Perform(request, response);
+    if (response.code == 200) {
+        co_return Status::OK();
+    }
+    co_return Status(EC_FAIL, OssErrorMessage(response));
+}
+
+AsyncTask<Status> OssSite::CopyFileFromLocalPartAsync(std::string srcPath,
+                                                      std::string dstPath,
+                                                      std::string uploadId,
+                                                      int partId,
+                                                      size_t offset,
+                                                      size_t size) {
+    auto [bucket, path] = SplitPath(dstPath);
+
+    OssEndpoint endpoint;
+    Status status = getOssEndpoint(endpoint, name_, bucket);
+    if (!status.ok()) {
+        co_return status;
+    }
+
+    ScopedFd file(srcPath);
+    if (file.fd < 0) {
+        co_return Status(EC_FAIL, "");
+    }
+    OssRequestPermit permit;
+    co_await permit.AcquireFor(endpoint.host);
+    HttpRequest request;
+    request.method = "PUT";
+    request.bodyFd = file.fd;
+    request.bodyOffset = offset;
+    request.bodySize = size;
+    AddTrafficLimit(request, true);
+    SignOssRequest(request,
+                   endpoint,
+                   bucket,
+                   path,
+                   {{"partNumber", std::to_string(partId)},
+                    {"uploadId", uploadId}});
+    HttpResponse response;
+    co_await ossEngine()->Perform(request, response);
+    if (response.code == 200) {
+        co_return Status::OK();
+    }
+    co_return Status(EC_FAIL, OssErrorMessage(response));
+}
+
+AsyncTask<Status> OssSite::CopyFileToLocalPartAsync(int fd,
+                                                    size_t position,
+                                                    std::string srcPath,
+                                                    size_t begin,
+                                                    size_t end,
+                                                    CancellationToken token) {
+    auto [bucket, path] = SplitPath(srcPath);
+
+    OssEndpoint endpoint;
+    Status status = getOssEndpoint(endpoint, name_, bucket);
+    if (!status.ok()) {
+        co_return status;
+    }
+
+    OssRequestPermit permit;
+    co_await permit.AcquireFor(endpoint.host);
+    HttpRequest request;
+    request.token = token;
+    request.headers.push_back("Range: bytes=" + std::to_string(begin) + "-" +
+                              std::to_string(end));
+    AddTrafficLimit(request, false);
+    SignOssRequest(request, endpoint, bucket, path);
+    size_t written = 0;
+    request.onData = [fd, position, &written](const char *data, size_t size) {
+        while (size > 0) {
+            ssize_t w = ::pwrite(fd, data, size, position + written);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += w;
+            size -= w;
+            written += w;
+        }
+        return true;
+    };
+    HttpResponse response;
+    co_await ossEngine()->Perform(request, response);
+    if (response.code / 100 == 2 && written == end - begin + 1) {
+        co_return Status::OK();
+    }
+    co_return Status(EC_FAIL, OssErrorMessage(response));
+}
+
+AsyncTask<Status> OssSite::HeadObjectAsync(std::string path,
+                                           FileStat &stat,
+                                           std::string &userETag) {
+    auto [bucket, name] = SplitPath(path);
+
+    OssEndpoint endpoint;
+    Status status = getOssEndpoint(endpoint, name_, bucket);
+    if (!status.ok()) {
+        co_return status;
+    }
+
+    OssRequestPermit permit;
+    co_await permit.AcquireFor(endpoint.host);
+    HttpRequest request;
+    request.method = "HEAD";
+    SignOssRequest(request, endpoint, bucket, name);
+    HttpResponse response;
+    co_await ossEngine()->Perform(request, response);
+    if (response.code != 200) {
+        co_return Status(EC_FAIL, OssErrorMessage(response));
+    }
+    auto &headers = response.headers;
+    stat.size = strtoull(headers["content-length"].c_str(), nullptr, 10);
+    stat.lastModifiedTime = ParseOssTime(headers["last-modified"], true);
+    std::string etag = headers["etag"];
+    if (etag.size() == 34) {
+        etag = etag.substr(1, 32);
+    }
+    stat.etag = etag.size() == 32 ? etag : "";
+    userETag = headers["x-oss-meta-useretag"];
+    co_return Status::OK();
+}
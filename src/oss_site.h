@@ -1,5 +1,7 @@
 #pragma once
 
+#include "async_task.h"
+#include "cancellation.h"
 #include "oss_client.h"
 #include "site.h"
 
@@ -16,6 +18,10 @@ public:
     bool IsOk() const override;
 
     Status GetDir(const std::string &path, DirPtr &dir) override;
+    Status GetDirInPages(const std::string &path,
+                         DirPtr &dir,
+                         const ListPageCallback &onPage,
+                         const CancellationToken &token) override;
     Status MakeDir(const std::string &path) override;
     Status Remove(const std::string &path) override;
 
@@ -59,17 +65,55 @@ public:
                                  size_t offset,
                                  size_t size);
 
-    Status CopyFileFromLocalPartFinish(const std::string &dstPath,
+    // Complete the upload of srcPath, read with srcStat, and have the hash
+    // service check and cache its multipart ETag.
+    Status CopyFileFromLocalPartFinish(const std::string &srcPath,
+                                       const FileStat &srcStat,
+                                       const std::string &dstPath,
                                        const std::string &uploadId);
 
     Status CopyFileFromLocalPartAbort(const std::string &bucket,
                                       const std::string &path,
                                       const std::string &uploadId);
 
-    Status CopyFileToLocalPart(std::shared_ptr<std::fstream> &out,
+    // Download [begin, end] of srcPath and write it to fd at position, the
+    // download is aborted once token is cancelled.
+    Status CopyFileToLocalPart(int fd,
+                               size_t position,
                                const std::string &srcPath,
                                size_t begin,
-                               size_t end);
+                               size_t end,
+                               const CancellationToken &token);
+
+    /**
+     * Awaitable variants sending through ossEngine(), which need no thread
+     * while the requests are in flight. They resume in an event loop thread
+     * of the engine, and references must outlive the awaited task.
+     */
+    AsyncTask<Status> ListObjectsAsync(std::string path, DirPtr &dir);
+
+    AsyncTask<Status> CopyFileFromLocalAsync(std::string srcPath,
+                                             std::string dstPath);
+
+    AsyncTask<Status> CopyFileFromLocalPartAsync(std::string srcPath,
+                                                 std::string dstPath,
+                                                 std::string uploadId,
+                                                 int partId,
+                                                 size_t offset,
+                                                 size_t size);
+
+    AsyncTask<Status> CopyFileToLocalPartAsync(int fd,
+                                               size_t position,
+                                               std::string srcPath,
+                                               size_t begin,
+                                               size_t end,
+                                               CancellationToken token);
+
+    // The size and time of path to stat, with the OSS ETag in stat.etag and
+    // the one of the uploaded file in userETag.
+    AsyncTask<Status> HeadObjectAsync(std::string path,
+                                      FileStat &stat,
+                                      std::string &userETag);
 
     static bool CheckProto(const std::string &path) {
         return path.substr(0, 6) == OSSPROTOP;
@@ -77,7 +121,10 @@ public:
 
 private:
     Status ListBuckets(DirPtr &dir);
-    Status ListObjects(const std::string &path, DirPtr &dir);
+    Status ListObjects(const std::string &path,
+                       DirPtr &dir,
+                       const ListPageCallback &onPage = {},
+                       const CancellationToken &token = {});
     Status Remove(const std::shared_ptr<oss::OssClient> &ossClient,
                   const std::string &path);
 
@@ -0,0 +1,55 @@
+#include "part_size_planner.h"
+
+#include <algorithm>
+
+namespace {
+constexpr size_t kMiB = 1024 * 1024;
+// Used before any part has been measured.
+constexpr size_t kDefaultPartSize = 8 * kMiB;
+// Smaller parts pay the request overhead too often.
+constexpr size_t kMinPlannedPartSize = 1 * kMiB;
+// Well under the 5GB part limit, the last part only takes the remainder.
+constexpr size_t kMaxPlannedPartSize = 2048 * kMiB;
+constexpr double kTargetPartSeconds = 10;
+// Keep at least this many parts so that the window has something to do.
+constexpr size_t kMinPartCount = 8;
+constexpr double kWeight = 0.3;
+} // namespace
+
+void PartThroughput::Record(Direction direction, size_t bytes, double seconds) {
+    if (seconds <= 0 || bytes < MIN_PART_SIZE) {
+        return;
+    }
+    double sample = bytes / seconds;
+    std::lock_guard<std::mutex> lck(mtx_);
+    double &average = bytesPerSecond_[(int)direction];
+    average = average == 0 ? sample
+                           : average * (1 - kWeight) + sample * kWeight;
+}
+
+double PartThroughput::BytesPerSecond(Direction direction) const {
+    std::lock_guard<std::mutex> lck(mtx_);
+    return bytesPerSecond_[(int)direction];
+}
+
+PartThroughput *partThroughput() {
+    static PartThroughput inst;
+    return &inst;
+}
+
+size_t PlanPartSize(size_t fileSize, double bytesPerSecond) {
+    size_t partSize = kDefaultPartSize;
+    if (bytesPerSecond > 0) {
+        partSize = bytesPerSecond * kTargetPartSeconds;
+    }
+    partSize = std::min(partSize, fileSize / kMinPartCount);
+    partSize = std::max(partSize, kMinPlannedPartSize);
+    // Round to whole MiB, then make sure the parts fit in the count limit.
+    partSize = (partSize + kMiB - 1) / kMiB * kMiB;
+    size_t minPartSize = (fileSize + MAX_PART_COUNT - 1) / MAX_PART_COUNT;
+    if (partSize < minPartSize) {
+        partSize = (minPartSize + kMiB - 1) / kMiB * kMiB;
+    }
+    partSize = std::min(partSize, kMaxPlannedPartSize);
+    return std::min(partSize, fileSize);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+#include "traffic.h"
+
+// OSS limits of multipart transfers.
+#define MAX_PART_COUNT 10000
+#define MIN_PART_SIZE (100 * 1024)
+
+/**
+ * Throughput of recently finished parts per direction, as an exponentially
+ * weighted moving average of the bytes per second of a single part request.
+ */
+class PartThroughput {
+public:
+    void Record(Direction direction, size_t bytes, double seconds);
+
+    // Zero until a part has been measured.
+    double BytesPerSecond(Direction direction) const;
+
+private:
+    mutable std::mutex mtx_;
+    double bytesPerSecond_[2]{0, 0};
+};
+
+PartThroughput *partThroughput();
+
+/**
+ * Choose the part size of a transfer. Parts are sized to take a few seconds
+ * each at the measured throughput, while keeping enough parts to fill the
+ * transfer window and staying under MAX_PART_COUNT. The file is split into
+ * fileSize / partSize parts, the last one taking the remainder, so parts are
+ * capped at 2GB and files above MAX_PART_COUNT * 2GB still exceed the count.
+ */
+size_t PlanPartSize(size_t fileSize, double bytesPerSecond);
@@ -106,7 +106,7 @@ void RemoveObjectsDialog::OnOk(wxCommandEvent &event) {
     processing_ = true;
     total_ = items_.size();
     allOk_ = true;
-    globalExecutor()->submit([this]() {
+    globalExecutor()->submit(Executor::kBackground, [this]() {
         for (size_t i = 0; i < items_.size(); i++) {
             if (cancel_) {
                 break;
@@ -176,7 +176,7 @@ void RemoveBucketsDialog::OnOk(wxCommandEvent &event) {
     processing_ = true;
     total_ = items_.size();
     allOk_ = true;
-    globalExecutor()->submit([this]() {
+    globalExecutor()->submit(Executor::kBackground, [this]() {
         for (size_t i = 0; i < items_.size(); i++) {
             if (cancel_) {
                 break;
@@ -7,23 +7,25 @@
 #include <wx/wx.h>
 #endif
 #include "defs.h"
-#include <wx/timer.h>
 
+#include <algorithm>
 #include <set>
 #include <ctime>
 
 namespace {
-class Looper : public wxTimer {
-public:
-    Looper(ScheduleList *scheduleList) : scheduleList_(scheduleList) {}
-
-    void Notify() override { scheduleList_->Schedule(); }
-
-private:
-    wxTimer timer_;
-    ScheduleList *scheduleList_;
-};
+constexpr const std::time_t oneminute = 1 * 60;
+constexpr const std::time_t onehour = 60 * oneminute;
+constexpr const std::time_t oneday = 24 * onehour;
+
+std::time_t IntervalOf(ScheduleRoutine routine) {
+    return routine == RTPerDay    ? oneday
+           : routine == RTPerHour ? onehour
+                                  : oneminute;
+}
 
+// A schedule runs again at most this long after it is due, so the timer of
+// the steady clock follows changes of the wall clock.
+constexpr const std::time_t maxsleep = onehour;
 } // namespace
 
 std::wstring ScheduleRoutineToWString(ScheduleRoutine routine) {
@@ -45,7 +47,8 @@ ScheduleList *scheduleList() {
 }
 
 ScheduleList::ScheduleList() {
-    static Looper looper(this);
+    // Create the timer wheel first, so it outlives the schedules.
+    timerWheel();
     schedules_ = storage()->LoadSchedules();
     for (const auto &s : schedules_) {
         if (s->lastStartTime && s->lastFinishTime) {
@@ -53,27 +56,20 @@ ScheduleList::ScheduleList() {
         }
     }
     wxTheApp->CallAfter([this]() { Schedule(); });
-    looper.Start(60 * 1000);
 }
 
 ScheduleList::~ScheduleList() {
+    timerWheel()->Cancel(timer_);
     for (const auto &s : schedules_) {
         storage()->UpdateSchedule(s);
     }
 }
 
 void ScheduleList::Schedule() {
-    constexpr const std::time_t oneminute = 1 * 60;
-    constexpr const std::time_t onehour = 60 * oneminute;
-    constexpr const std::time_t oneday = 24 * onehour;
-
     std::time_t now = std::time(nullptr);
     for (const auto &s : schedules_) {
         if (!s->lastStartTime || s->lastFinishTime) {
-            std::time_t interval = s->routine == RTPerDay    ? oneday
-                                   : s->routine == RTPerHour ? onehour
-                                                             : oneminute;
-            if (now - s->lastFinishTime >= interval) {
+            if (now - s->lastFinishTime >= IntervalOf(s->routine)) {
                 s->lastStartTime = now;
                 s->lastFinishTime = 0;
                 taskList()->AddTask(TTSync,
@@ -85,6 +81,32 @@ void ScheduleList::Schedule() {
             }
         }
     }
+    Arm();
+}
+
+void ScheduleList::Arm() {
+    timerWheel()->Cancel(timer_);
+    timer_ = 0;
+
+    std::time_t now = std::time(nullptr);
+    std::time_t next = now + maxsleep;
+    bool waiting = false;
+    for (const auto &s : schedules_) {
+        // Running schedules are armed again when they finish.
+        if (!s->lastStartTime || s->lastFinishTime) {
+            next = std::min(next, s->lastFinishTime + IntervalOf(s->routine));
+            waiting = true;
+        }
+    }
+    if (!waiting) {
+        return;
+    }
+    // The timer fires in the timer thread, the schedules are only touched in
+    // the main thread.
+    timer_ = timerWheel()->Add(
+            TimerWheel::Clock::now() +
+                    std::chrono::seconds(std::max<std::time_t>(next - now, 0)),
+            [this]() { wxTheApp->CallAfter([this]() { Schedule(); }); });
 }
 
 Status ScheduleList::Add(SchedulePtr &schedule) {
@@ -97,6 +119,7 @@ Status ScheduleList::Add(SchedulePtr &schedule) {
     }
     storage()->AppendSchedule(schedule);
     schedules_.push_back(schedule);
+    Arm();
 
     return Status::OK();
 }
@@ -109,11 +132,13 @@ void ScheduleList::Remove(const SchedulePtr &schedule) {
     schedules_.erase(
             std::remove(schedules_.begin(), schedules_.end(), schedule),
             schedules_.end());
+    Arm();
 }
 
 void ScheduleList::Remove(size_t index) {
     storage()->RemoveSchedule(schedules_[index]);
     schedules_.erase(schedules_.begin() + index);
+    Arm();
 }
 
 void ScheduleList::Finished(long scheduleId) {
@@ -123,6 +148,7 @@ void ScheduleList::Finished(long scheduleId) {
             break;
         }
     }
+    Arm();
 }
 
 std::string ScheduleList::MakeTempName() const {
@@ -7,6 +7,7 @@
 
 #include "status.h"
 #include "task_list.h"
+#include "timer_wheel.h"
 
 enum ScheduleRoutine {
     RTOnce,
@@ -52,7 +53,11 @@ public:
     bool NameExists(const std::string &name) const;
 
 private:
+    // Set the timer for the schedule due first, replacing the last one.
+    void Arm();
+
     SchedulePtrVec schedules_;
+    TimerWheel::TimerId timer_{0};
 };
 
 ScheduleList *scheduleList();
@@ -4,6 +4,7 @@
 #include <alibabacloud/oss/OssClient.h>
 
 #include "global_executor.h"
+#include "listing_cache.h"
 
 #include <wx/wxprec.h>
 #ifndef WX_PRECOMP
@@ -25,22 +26,6 @@ std::wstring fileTypeToStdWstring(FileType fileType) {
     return L"";
 }
 
-DirPtr Dir::CopyBasic() {
-    DirPtr dir(new Dir(path));
-
-    dir->path = path;
-    dir->tag = tag;
-
-    dir->files.reserve(files.size());
-    for (const auto &file : files) {
-        FilePtr f(new File);
-        *f = *file;
-        dir->files.push_back(f);
-    }
-
-    return dir;
-}
-
 void DirectoryCenter::Register(DirectoryListener *listener) {
     std::lock_guard<std::mutex> lck(mtx_);
     if (std::find(listeners_.begin(), listeners_.end(), listener) ==
@@ -58,6 +43,7 @@ void DirectoryCenter::Unregister(DirectoryListener *listener) {
 
 void DirectoryCenter::NotifyDirectoryUpdated(const std::string &site,
                                              const std::string &path) {
+    listingCache()->Invalidate(site, path);
     std::unique_lock<std::mutex> lck(mtx_);
     std::vector<DirectoryListener *> listeners = listeners_;
     lck.unlock();
@@ -77,7 +63,10 @@ DirectoryCenter *directoryCenter() {
     return &inst;
 }
 
-Site::Site(SiteType type) : type_(type), currentDir_(new Dir("")) {
+Site::Site(SiteType type)
+    : type_(type),
+      listingToken_(shutdownToken().child()),
+      currentDir_(new Dir("")) {
 }
 
 Site::~Site() {
@@ -120,34 +109,76 @@ void Site::ChangeDir(const std::string &requestPath, SiteUpdatedCallback cb) {
         }
     }
 
-    updatingPath_ = path;
+    CancelListing();
     pendingPath_ = "";
-    globalExecutor()->submit([this, path, cb]() {
+    if (type_ == STOss) {
+        bool fresh = false;
+        if (DirPtr dir = listingCache()->Get(name(), path, fresh)) {
+            // Shown at once, and listed again below if stale.
+            updatingPath_ = fresh ? "" : path;
+            SetCurrentDir(dir);
+            if (cb) {
+                cb(this, Status::OK());
+            }
+            if (fresh) {
+                return;
+            }
+            cb = {};
+        }
+    }
+
+    updatingPath_ = path;
+    CancellationToken token = listingToken_;
+    // Another directory, or the first one, is shown page by page. The one
+    // shown is kept till listed again.
+    bool inPages = currentDir_->path != path || currentDir_->files.empty();
+    uint64_t version = listingCache()->Version();
+    globalExecutor()->submit(Executor::kInteractive, [=, this]() {
+        ListPageCallback onPage;
+        if (inPages) {
+            onPage = [this, path, token](const Dir &dir, size_t from) {
+                DirPtr page(new Dir(dir.path));
+                page->tag = dir.tag;
+                page->dirCount = dir.dirCount;
+                page->fileCount = dir.fileCount;
+                page->totalSize = dir.totalSize;
+                page->files.assign(dir.files.begin() + from, dir.files.end());
+                wxTheApp->CallAfter([this, path, token, page]() {
+                    if (!token.cancelled() && updatingPath_ == path) {
+                        ShowPage(page);
+                    }
+                });
+            };
+        }
         DirPtr dir;
-        Status status = GetDir(path, dir);
-        wxTheApp->CallAfter([this, status, path, dir, cb]() {
-            if (updatingPath_ == path) {
+        Status status = GetDirInPages(path, dir, onPage, token);
+        // Only a complete listing is shared, a failed one is listed again.
+        if (status.ok() && type_ == STOss) {
+            listingCache()->Put(name(), path, dir, version);
+        }
+        wxTheApp->CallAfter([this, status, path, dir, cb, token]() {
+            // A listing cancelled for another one of the same path is stale.
+            if (!token.cancelled() && updatingPath_ == path) {
                 updatingPath_ = "";
                 if (status.ok()) {
-                    if (currentDir_->path != dir->path) {
-                        forwards_.clear();
-                        backwards_.emplace_front(std::move(currentDir_));
-                        if (backwards_.size() > HISTORYCAP) {
-                            backwards_.pop_back();
-                        }
-                    }
-                    currentDir_ = dir;
-                    NotifyChanged();
+                    SetCurrentDir(dir);
+                } else {
+                    DropPartialListing();
+                    // No page of a failed listing is left shown.
+                    assert(!currentDir_->listing);
                 }
 
                 if (cb) {
                     cb(this, status);
+                } else if (!status.ok()) {
+                    wxBell();
                 }
 
                 if (!pendingPath_.empty()) {
                     std::string pendingPath = std::move(pendingPath_);
                     // Currently can only pending refresh without callback
-                    assert(pendingPath == dir->path);
+                    assert(pendingPath == path);
+                    InvalidateListing(pendingPath);
                     ChangeDir(pendingPath);
                 }
             }
@@ -155,6 +186,67 @@ void Site::ChangeDir(const std::string &requestPath, SiteUpdatedCallback cb) {
     });
 }
 
+void Site::SetCurrentDir(const DirPtr &dir) {
+    if (currentDir_->path != dir->path) {
+        forwards_.clear();
+        if (!currentDir_->listing) {
+            backwards_.emplace_front(std::move(currentDir_));
+            if (backwards_.size() > HISTORYCAP) {
+                backwards_.pop_back();
+            }
+        }
+    }
+    currentDir_ = dir;
+    NotifyChanged();
+}
+
+void Site::ShowPage(const DirPtr &page) {
+    if (currentDir_->path != page->path || !currentDir_->listing) {
+        page->listing = true;
+        SetCurrentDir(page);
+        return;
+    }
+    currentDir_->dirCount = page->dirCount;
+    currentDir_->fileCount = page->fileCount;
+    currentDir_->totalSize = page->totalSize;
+    currentDir_->files.insert(
+            currentDir_->files.end(), page->files.begin(), page->files.end());
+    NotifyFilesAppended();
+}
+
+void Site::DropPartialListing() {
+    if (!currentDir_->listing) {
+        return;
+    }
+    // Back to where the listing started from, its pages are incomplete.
+    if (!backwards_.empty()) {
+        currentDir_ = std::move(backwards_.front());
+        backwards_.pop_front();
+    } else {
+        currentDir_->files.clear();
+        currentDir_->listing = false;
+    }
+    NotifyChanged();
+}
+
+void Site::CancelListing() {
+    listingToken_.cancel();
+    listingToken_ = shutdownToken().child();
+}
+
+Status Site::GetDirInPages(const std::string &path,
+                           DirPtr &dir,
+                           const ListPageCallback &,
+                           const CancellationToken &) {
+    return GetDir(path, dir);
+}
+
+void Site::InvalidateListing(const std::string &path) {
+    if (type_ == STOss) {
+        listingCache()->Invalidate(name(), path);
+    }
+}
+
 void Site::ChangeToSubDir(const std::string &subdir, SiteUpdatedCallback cb) {
     ChangeDir(GetCurrentPath() + subdir + "/", cb);
 }
@@ -180,6 +272,7 @@ void Site::Refresh(bool immediately, SiteUpdatedCallback cb) {
         }
     }
 
+    InvalidateListing(GetCurrentPath());
     ChangeDir(GetCurrentPath(), cb);
 }
 
@@ -191,9 +284,12 @@ void Site::Backward() {
 
     updatingPath_ = "";
     pendingPath_ = "";
+    CancelListing();
 
     if (!backwards_.empty()) {
-        forwards_.push_front(std::move(currentDir_));
+        if (!currentDir_->listing) {
+            forwards_.push_front(std::move(currentDir_));
+        }
         currentDir_ = std::move(backwards_.front());
         backwards_.pop_front();
         NotifyChanged();
@@ -208,9 +304,12 @@ void Site::Forward() {
 
     updatingPath_ = "";
     pendingPath_ = "";
+    CancelListing();
 
     if (!forwards_.empty()) {
-        backwards_.push_front(std::move(currentDir_));
+        if (!currentDir_->listing) {
+            backwards_.push_front(std::move(currentDir_));
+        }
         currentDir_ = std::move(forwards_.front());
         forwards_.pop_front();
         NotifyChanged();
@@ -275,6 +374,12 @@ void Site::NotifyChanged() {
     }
 }
 
+void Site::NotifyFilesAppended() {
+    for (auto *l : listeners_) {
+        l->SiteFilesAppended(this);
+    }
+}
+
 bool IsSubDir(const std::string &base, const std::string &path) {
     return base.size() <= path.size() &&
            !std::strncmp(base.c_str(), path.c_str(), base.size());
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <ctime>
 #include <deque>
+#include <functional>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "cancellation.h"
 #include "status.h"
 
 /**
@@ -21,7 +25,7 @@ enum FileType { FTDirectory, FTFile };
 
 std::wstring fileTypeToStdWstring(FileType fileType);
 
-enum CmpResult {
+enum CmpResult : uint8_t {
     CSNone,
     CSEqual,
     CSNew,
@@ -34,12 +38,14 @@ struct FileStat {
     size_t size{0};
     std::time_t lastModifiedTime{0};
     std::string etag;
+    // The ETag OSS lists for a multipart upload, with the part count after
+    // a dash, while etag is then empty.
+    std::string partETag;
 };
 
 struct File {
     std::string name;
     FileType type;
-    CmpResult cmp;
     FileStat stat;
     std::string location; // for bucket
     int icon{-2};
@@ -64,9 +70,14 @@ struct Dir {
     bool compareRunning{false};
     bool compareEnable{false};
 
-    std::vector<FilePtr> files;
+    // Still being listed, the files of each page are appended in main thread
+    // as it arrives. Compare waits for the listing to finish.
+    bool listing{false};
 
-    DirPtr CopyBasic();
+    // Files are not changed once listed, compare reads them in any thread.
+    std::vector<FilePtr> files;
+    // Compare results by index of files, set in main thread when done.
+    std::vector<CmpResult> cmps;
 };
 
 struct DirectoryListener {
@@ -97,10 +108,16 @@ class SiteListener {
 public:
     virtual ~SiteListener() = default;
     virtual void SiteUpdated(Site *site) = 0;
+    // A page of files was appended to the current dir, still listing.
+    virtual void SiteFilesAppended(Site *) {}
 };
 
 using SiteUpdatedCallback = std::function<void(Site *, Status)>;
 
+// Called in the listing thread with dir being listed, its files from from on
+// being the page just listed.
+using ListPageCallback = std::function<void(const Dir &dir, size_t from)>;
+
 class Site : public DirectoryListener {
 public:
     Site(SiteType type);
@@ -133,6 +150,13 @@ public:
 
     // block method to list dir, caller should put this into thread
     virtual Status GetDir(const std::string &path, DirPtr &dir) = 0;
+
+    // GetDir calling onPage after every page but the last, and stopping once
+    // token is cancelled. By default the dir is listed in one go.
+    virtual Status GetDirInPages(const std::string &path,
+                                 DirPtr &dir,
+                                 const ListPageCallback &onPage,
+                                 const CancellationToken &token);
     virtual Status MakeDir(const std::string &path) = 0;
     virtual Status Remove(const std::string &path) = 0;
 
@@ -177,16 +201,33 @@ public:
     SiteType type() const { return type_; }
 
     void NotifyChanged();
+    void NotifyFilesAppended();
 
     std::string comparePath_;
 
 protected:
+    // Show dir, keeping the one shown in the history if of another path and
+    // fully listed.
+    void SetCurrentDir(const DirPtr &dir);
+
+    // Show the first page of a listing, or append a later one.
+    void ShowPage(const DirPtr &page);
+
+    // Stop the listing running, if any.
+    void CancelListing();
+
+    // Leave a listing that failed partway, showing the previous dir again.
+    void DropPartialListing();
+
+    // Have path listed again instead of taken from the listing cache.
+    void InvalidateListing(const std::string &path);
+
     SiteType type_;
     bool directoryCenterWatched_{false};
 
     std::string updatingPath_;
     std::string pendingPath_;
-
+    CancellationToken listingToken_;
 
     std::vector<SiteListener *> listeners_;
 
@@ -1,5 +1,6 @@
 #include "statusbar.h"
 
+#include "executor.h"
 #include "traffic.h"
 #include "traffic_setting_dialog.h"
 
@@ -13,8 +14,8 @@ END_EVENT_TABLE();
 
 StatusBar::StatusBar(wxWindow *parent)
     : wxStatusBar(parent, wxID_ANY, wxSTB_DEFAULT_STYLE) {
-    int widths[] = {-1, 16, 16, 8};
-    SetFieldsCount(4, widths);
+    int widths[] = {-1, 200, 16, 16, 8};
+    SetFieldsCount(5, widths);
     leds_[0] = new Led(this, 1);
     leds_[1] = new Led(this, 0);
 
@@ -22,6 +23,8 @@ StatusBar::StatusBar(wxWindow *parent)
     leds_[1]->Bind(wxEVT_LEFT_UP, &StatusBar::OnLeftMouseUp, this);
 
     timer_.SetOwner(this);
+    statsTimer_.SetOwner(this);
+    statsTimer_.Start(1000);
 }
 
 void StatusBar::UpdateActivityLed() {
@@ -38,7 +41,24 @@ void StatusBar::Light() {
     leds_[(int)Direction::Recv]->Set(Traffic::IsOn(Direction::Recv));
 }
 
+// Sum of the tasks running and waiting in all executors.
+void StatusBar::UpdateExecutorStats() {
+    size_t active = 0;
+    size_t queued = 0;
+    Executor::ForEach([&active, &queued](const Executor &executor) {
+        active += executor.stats().active();
+        queued += executor.stats().queued();
+    });
+    SetStatusText(wxString::Format(
+                          _("Running %d, queued %d"), (int)active, (int)queued),
+                  1);
+}
+
 void StatusBar::OnTimer(wxTimerEvent &event) {
+    if (event.GetId() == statsTimer_.GetId()) {
+        UpdateExecutorStats();
+        return;
+    }
     if (!timer_.IsRunning()) {
         return;
     }
@@ -60,12 +80,12 @@ void StatusBar::OnSize(wxSizeEvent &event) {
     wxRect rect;
     GetFieldRect(0, rect);
 
-    GetFieldRect(1, rect);
+    GetFieldRect(2, rect);
     wxSize size = leds_[0]->GetSize();
     leds_[0]->Move(rect.x + (rect.width - size.x) / 2,
                    rect.y + (rect.height - size.y) / 2);
 
-    GetFieldRect(2, rect);
+    GetFieldRect(3, rect);
     leds_[1]->Move(rect.x + (rect.width - size.x) / 2,
                    rect.y + (rect.height - size.y) / 2);
 
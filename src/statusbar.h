@@ -12,6 +12,7 @@ public:
     StatusBar(wxWindow *parent);
     void UpdateActivityLed();
     void Light();
+    void UpdateExecutorStats();
 
     void OnTimer(wxTimerEvent& event);
     void OnSize(wxSizeEvent &event);
@@ -23,6 +24,7 @@ private:
     Led *leds_[2];
     wxTimer timer_;
     int timerIdle_;
+    wxTimer statsTimer_;
 
     DECLARE_EVENT_TABLE()
 };
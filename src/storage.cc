@@ -2,9 +2,15 @@
 
 #include <sqlite3.h>
 
+#include <chrono>
+#include <ctime>
 #include <iostream>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "osspanapp.h"
@@ -123,6 +129,8 @@ enum {
     progress,
     startTime,
     finishTime,
+    parts,
+    partSize,
     lastId,
 };
 } // namespace TableTaskColumns
@@ -148,6 +156,60 @@ Table TableTask{
                 {"progress", CTInteger, NotNull},
                 {"startTime", CTInteger, 0},
                 {"finishTime", CTInteger, 0},
+                {"parts", CTText, 0},
+                {"partSize", CTInteger, 0},
+        },
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+};
+
+namespace TableHashColumns {
+enum {
+    id,
+    path,
+    device,
+    inode,
+    size,
+    mtime,
+    etag,
+    partETag,
+    used,
+    lastId,
+};
+} // namespace TableHashColumns
+
+// Index of column in the hash lookup, which selects the columns in table
+// order from device on.
+constexpr int HashLookupIndex(int column) {
+    return column - TableHashColumns::device;
+}
+
+// Hashes are written once this many writes are pending, or the oldest
+// waited the delay, each batch in one transaction.
+constexpr size_t kHashBatch = 256;
+constexpr auto kHashFlushDelay = std::chrono::seconds(2);
+// Rows neither stored nor looked up for this long are dropped when opened,
+// which is how the hashes of deleted and moved files go away.
+constexpr std::time_t kHashMaxAge = 30 * 24 * 3600;
+// A row looked up has its last use written again once it is this old, not
+// on every lookup.
+constexpr std::time_t kHashUseResolution = 24 * 3600;
+
+// Content ETags of local files, valid while the file keeps its key.
+Table TableHash{
+        "hashes",
+        {
+                {"id", CTInteger, PrimaryKey | NotNull},
+                {"path", CTText, NotNull},
+                {"device", CTInteger, NotNull},
+                {"inode", CTInteger, NotNull},
+                {"size", CTInteger, NotNull},
+                {"mtime", CTInteger, NotNull},
+                {"etag", CTText, NotNull},
+                {"partETag", CTText, DefaultNull},
+                {"used", CTInteger, DefaultNull},
         },
         nullptr,
         nullptr,
@@ -159,6 +221,7 @@ std::vector<Table *> schemas{
         &TableSite,
         &TableTask,
         &TableSchedule,
+        &TableHash,
 };
 
 } // namespace
@@ -184,7 +247,33 @@ public:
     void UpdateTask(const TaskPtr &task);
     void RemoveTask(const TaskPtr &task);
 
+    bool LookupHash(const std::string &path,
+                    const HashKey &key,
+                    std::string &etag);
+    void StoreHash(const std::string &path,
+                   const HashKey &key,
+                   const std::string &etag);
+    bool LookupPartHash(const std::string &path,
+                        const HashKey &key,
+                        std::string &partETag);
+    void StorePartHash(const std::string &path,
+                       const HashKey &key,
+                       const std::string &partETag);
+
     void CreateTables();
+    void PrepareHashStatements();
+    void PruneHashes();
+    // Write the pending hashes and uses, with hashMtx held.
+    void FlushHashes();
+    // Flush once enough are pending or waited long enough.
+    void MaybeFlushHashes();
+    // Column of TableHashColumns, etag or partETag, if the row of path has
+    // key.
+    bool LookupHashColumn(const std::string &path,
+                          const HashKey &key,
+                          int column,
+                          std::string &value);
+    void MigrateTable(Table *table);
     void CreateColumnDef(std::ostringstream &ss, const Column &column);
     void PrepareSelectStatement(Table *table);
     void PrepareInsertStatement(Table *table);
@@ -205,16 +294,43 @@ public:
 
 private:
     sqlite3 *db{nullptr};
+
+    // The hashes are looked up and stored by the hash threads, everything
+    // else runs in the main thread.
+    std::mutex hashMtx;
+    sqlite3_stmt *hashLookup{nullptr};
+    sqlite3_stmt *hashStore{nullptr};
+    sqlite3_stmt *hashPartStore{nullptr};
+    sqlite3_stmt *hashUse{nullptr};
+
+    struct PendingHash {
+        HashKey key;
+        // Empty if only the part ETag is added to the row stored.
+        std::string etag;
+        std::string partETag;
+    };
+    // Stored but not written yet, by path, and since when.
+    std::unordered_map<std::string, PendingHash> pendingHashes;
+    // Rows looked up whose last use is to be written.
+    std::unordered_set<std::string> pendingUses;
+    std::chrono::steady_clock::time_point pendingSince;
 };
 
 Storage::Impl::Impl() {
     std::string dataPath = wxGetApp().GetUserDataDir().ToStdString();
     std::string dbFile = dataPath + "/Osspan.db";
-    int ret = sqlite3_open(dbFile.c_str(), &db);
+    // Serialized, the hash cache is used from other threads.
+    int ret = sqlite3_open_v2(dbFile.c_str(),
+                              &db,
+                              SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                                      SQLITE_OPEN_FULLMUTEX,
+                              nullptr);
     if (ret != SQLITE_OK) {
         throw "sqlite3 open";
     }
     CreateTables();
+    PrepareHashStatements();
+    PruneHashes();
 }
 
 Storage::Impl::~Impl() {
@@ -225,6 +341,14 @@ Storage::Impl::~Impl() {
             sqlite3_finalize(table->update);
         }
     }
+    {
+        std::lock_guard<std::mutex> lck(hashMtx);
+        FlushHashes();
+    }
+    sqlite3_finalize(hashLookup);
+    sqlite3_finalize(hashStore);
+    sqlite3_finalize(hashPartStore);
+    sqlite3_finalize(hashUse);
     sqlite3_close(db);
 }
 
@@ -495,6 +619,10 @@ TaskPtrVec Storage::Impl::LoadTasks() {
                     TableTask.select, TableTaskColumns::startTime, 0);
             task->finishTime = GetColumnInt64(
                     TableTask.select, TableTaskColumns::finishTime, 0);
+            task->parts =
+                    GetColumnString(TableTask.select, TableTaskColumns::parts);
+            task->partSize = GetColumnInt64(
+                    TableTask.select, TableTaskColumns::partSize, 0);
             v.push_back(task);
         }
     } while (rc == SQLITE_ROW || rc == SQLITE_BUSY);
@@ -555,6 +683,8 @@ void Storage::Impl::AppendTask(const TaskPtr &task) {
     Bind(TableTask.insert,
          TableTaskColumns::finishTime,
          (int64_t)task->finishTime);
+    Bind(TableTask.insert, TableTaskColumns::parts, task->parts);
+    Bind(TableTask.insert, TableTaskColumns::partSize, (int64_t)task->partSize);
 
     int rc;
     do {
@@ -596,6 +726,8 @@ void Storage::Impl::UpdateTask(const TaskPtr &task) {
     Bind(TableTask.update,
          TableTaskColumns::finishTime,
          (int64_t)task->finishTime);
+    Bind(TableTask.update, TableTaskColumns::parts, task->parts);
+    Bind(TableTask.update, TableTaskColumns::partSize, (int64_t)task->partSize);
     Bind(TableTask.update, TableTaskColumns::lastId, (int64_t)task->id);
 
     int rc;
@@ -620,6 +752,213 @@ void Storage::Impl::RemoveTask(const TaskPtr &task) {
     sqlite3_reset(TableTask.remove);
 }
 
+bool Storage::Impl::LookupHash(const std::string &path,
+                               const HashKey &key,
+                               std::string &etag) {
+    return LookupHashColumn(path, key, TableHashColumns::etag, etag);
+}
+
+bool Storage::Impl::LookupPartHash(const std::string &path,
+                                   const HashKey &key,
+                                   std::string &partETag) {
+    return LookupHashColumn(path, key, TableHashColumns::partETag, partETag);
+}
+
+bool Storage::Impl::LookupHashColumn(const std::string &path,
+                                     const HashKey &key,
+                                     int column,
+                                     std::string &value) {
+    std::lock_guard<std::mutex> lck(hashMtx);
+    // The row pending replaces the one stored, a part ETag alone pending is
+    // added to it.
+    const PendingHash *pending = nullptr;
+    auto it = pendingHashes.find(path);
+    if (it != pendingHashes.end()) {
+        pending = &it->second;
+        if (!pending->etag.empty()) {
+            const std::string &pendingValue =
+                    column == TableHashColumns::etag ? pending->etag
+                                                     : pending->partETag;
+            if (pending->key != key || pendingValue.empty()) {
+                return false;
+            }
+            value = pendingValue;
+            return true;
+        }
+    }
+
+    Bind(hashLookup, 1, path);
+
+    int rc;
+    do {
+        rc = sqlite3_step(hashLookup);
+    } while (rc == SQLITE_BUSY);
+
+    bool found = false;
+    if (rc == SQLITE_ROW) {
+        HashKey stored;
+        stored.device = GetColumnInt64(
+                hashLookup, HashLookupIndex(TableHashColumns::device), -1);
+        stored.inode = GetColumnInt64(
+                hashLookup, HashLookupIndex(TableHashColumns::inode), -1);
+        stored.size = GetColumnInt64(
+                hashLookup, HashLookupIndex(TableHashColumns::size), -1);
+        stored.mtime = GetColumnInt64(
+                hashLookup, HashLookupIndex(TableHashColumns::mtime), -1);
+        if (stored == key) {
+            value = GetColumnString(hashLookup, HashLookupIndex(column));
+            if (column == TableHashColumns::partETag && pending &&
+                pending->key == key) {
+                value = pending->partETag;
+            }
+            found = !value.empty();
+        }
+        int64_t used = GetColumnInt64(
+                hashLookup, HashLookupIndex(TableHashColumns::used), 0);
+        if (found && used < std::time(nullptr) - kHashUseResolution) {
+            if (pendingHashes.empty() && pendingUses.empty()) {
+                pendingSince = std::chrono::steady_clock::now();
+            }
+            pendingUses.insert(path);
+        }
+    }
+    sqlite3_reset(hashLookup);
+    if (found) {
+        MaybeFlushHashes();
+    }
+    return found;
+}
+
+void Storage::Impl::StoreHash(const std::string &path,
+                              const HashKey &key,
+                              const std::string &etag) {
+    std::lock_guard<std::mutex> lck(hashMtx);
+    if (pendingHashes.empty() && pendingUses.empty()) {
+        pendingSince = std::chrono::steady_clock::now();
+    }
+    pendingHashes[path] = {key, etag, ""};
+    MaybeFlushHashes();
+}
+
+void Storage::Impl::StorePartHash(const std::string &path,
+                                  const HashKey &key,
+                                  const std::string &partETag) {
+    std::lock_guard<std::mutex> lck(hashMtx);
+    if (pendingHashes.empty() && pendingUses.empty()) {
+        pendingSince = std::chrono::steady_clock::now();
+    }
+    auto it = pendingHashes.find(path);
+    if (it != pendingHashes.end() && !it->second.etag.empty()) {
+        // Only added to the row of the same file.
+        if (it->second.key == key) {
+            it->second.partETag = partETag;
+        }
+    } else {
+        pendingHashes[path] = {key, "", partETag};
+    }
+    MaybeFlushHashes();
+}
+
+void Storage::Impl::MaybeFlushHashes() {
+    if (pendingHashes.size() + pendingUses.size() >= kHashBatch ||
+        std::chrono::steady_clock::now() - pendingSince >= kHashFlushDelay) {
+        FlushHashes();
+    }
+}
+
+void Storage::Impl::FlushHashes() {
+    if (pendingHashes.empty() && pendingUses.empty()) {
+        return;
+    }
+    bool transaction = BeginTransaction();
+    int64_t used = std::time(nullptr);
+    for (const auto &[path, pending] : pendingHashes) {
+        int rc;
+        if (!pending.etag.empty()) {
+            Bind(hashStore, TableHashColumns::path, path);
+            Bind(hashStore, TableHashColumns::device, pending.key.device);
+            Bind(hashStore, TableHashColumns::inode, pending.key.inode);
+            Bind(hashStore, TableHashColumns::size, pending.key.size);
+            Bind(hashStore, TableHashColumns::mtime, pending.key.mtime);
+            Bind(hashStore, TableHashColumns::etag, pending.etag);
+            if (pending.partETag.empty()) {
+                sqlite3_bind_null(hashStore, TableHashColumns::partETag);
+            } else {
+                Bind(hashStore, TableHashColumns::partETag, pending.partETag);
+            }
+            Bind(hashStore, TableHashColumns::used, used);
+            do {
+                rc = sqlite3_step(hashStore);
+            } while (rc == SQLITE_BUSY);
+            sqlite3_reset(hashStore);
+        } else {
+            Bind(hashPartStore, 1, pending.partETag);
+            Bind(hashPartStore, 2, path);
+            Bind(hashPartStore, 3, pending.key.device);
+            Bind(hashPartStore, 4, pending.key.inode);
+            Bind(hashPartStore, 5, pending.key.size);
+            Bind(hashPartStore, 6, pending.key.mtime);
+            do {
+                rc = sqlite3_step(hashPartStore);
+            } while (rc == SQLITE_BUSY);
+            sqlite3_reset(hashPartStore);
+        }
+    }
+    for (const auto &path : pendingUses) {
+        Bind(hashUse, 1, used);
+        Bind(hashUse, 2, path);
+        int rc;
+        do {
+            rc = sqlite3_step(hashUse);
+        } while (rc == SQLITE_BUSY);
+        sqlite3_reset(hashUse);
+    }
+    if (transaction) {
+        EndTransaction(false);
+    }
+    pendingHashes.clear();
+    pendingUses.clear();
+}
+
+void Storage::Impl::PruneHashes() {
+    sqlite3_stmt *stmt = PrepareStatement(
+            "DELETE FROM hashes WHERE used IS NULL OR used < :before");
+    Bind(stmt, 1, int64_t(std::time(nullptr) - kHashMaxAge));
+    int rc;
+    do {
+        rc = sqlite3_step(stmt);
+    } while (rc == SQLITE_BUSY);
+    sqlite3_finalize(stmt);
+}
+
+// One row per path, replaced when the file is hashed again.
+void Storage::Impl::PrepareHashStatements() {
+    if (sqlite3_exec(db,
+                     "CREATE UNIQUE INDEX IF NOT EXISTS hashes_path "
+                     "ON hashes (path)",
+                     0,
+                     0,
+                     0) != SQLITE_OK) {
+        throw "sqlite3 exec";
+    }
+    hashLookup = PrepareStatement(
+            "SELECT device, inode, size, mtime, etag, partETag, used "
+            "FROM hashes WHERE path = :path");
+    // Parameters numbered like TableHashColumns, path is the first.
+    hashStore = PrepareStatement(
+            "INSERT OR REPLACE INTO hashes "
+            "(path, device, inode, size, mtime, etag, partETag, used) "
+            "VALUES (:path, :device, :inode, :size, :mtime, :etag, :partETag, "
+            ":used)");
+    // Only added to the row of the same file.
+    hashPartStore = PrepareStatement(
+            "UPDATE hashes SET partETag = :partETag WHERE path = :path AND "
+            "device = :device AND inode = :inode AND size = :size AND "
+            "mtime = :mtime");
+    hashUse = PrepareStatement(
+            "UPDATE hashes SET used = :used WHERE path = :path");
+}
+
 void Storage::Impl::CreateTables() {
     for (auto *table : schemas) {
         std::ostringstream ss;
@@ -638,6 +977,7 @@ void Storage::Impl::CreateTables() {
         if (sqlite3_exec(db, query.c_str(), 0, 0, 0) != SQLITE_OK) {
             throw "sqlite3 exec";
         }
+        MigrateTable(table);
         PrepareSelectStatement(table);
         PrepareInsertStatement(table);
         PrepareUpdateStatement(table);
@@ -645,6 +985,37 @@ void Storage::Impl::CreateTables() {
     }
 }
 
+/**
+ * Add the columns which were introduced after the table was created, new
+ * columns should not be NotNull since old rows have no value for them.
+ */
+void Storage::Impl::MigrateTable(Table *table) {
+    std::set<std::string> existing;
+    sqlite3_stmt *stmt = PrepareStatement(std::string("PRAGMA table_info(") +
+                                          std::string(table->name) + ")");
+    int rc;
+    do {
+        rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW) {
+            existing.insert(GetColumnString(stmt, 1));
+        }
+    } while (rc == SQLITE_ROW || rc == SQLITE_BUSY);
+    sqlite3_finalize(stmt);
+
+    for (const auto &column : table->columns) {
+        if (existing.count(std::string(column.name))) {
+            continue;
+        }
+        std::ostringstream ss;
+        ss << "ALTER TABLE " << table->name << " ADD COLUMN ";
+        CreateColumnDef(ss, column);
+        std::string query = ss.str();
+        if (sqlite3_exec(db, query.c_str(), 0, 0, 0) != SQLITE_OK) {
+            throw "sqlite3 exec";
+        }
+    }
+}
+
 void Storage::Impl::CreateColumnDef(std::ostringstream &ss,
                                     const Column &column) {
     ss << column.name;
@@ -851,6 +1222,30 @@ void Storage::RemoveTask(const TaskPtr &task) {
     impl->RemoveTask(task);
 }
 
+bool Storage::LookupHash(const std::string &path,
+                         const HashKey &key,
+                         std::string &etag) {
+    return impl->LookupHash(path, key, etag);
+}
+
+void Storage::StoreHash(const std::string &path,
+                        const HashKey &key,
+                        const std::string &etag) {
+    impl->StoreHash(path, key, etag);
+}
+
+bool Storage::LookupPartHash(const std::string &path,
+                             const HashKey &key,
+                             std::string &partETag) {
+    return impl->LookupPartHash(path, key, partETag);
+}
+
+void Storage::StorePartHash(const std::string &path,
+                            const HashKey &key,
+                            const std::string &partETag) {
+    impl->StorePartHash(path, key, partETag);
+}
+
 Storage *storage() {
     static std::unique_ptr<Storage> inst(new Storage);
     return inst.get();
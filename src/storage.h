@@ -4,8 +4,20 @@
 #include "schedule_list.h"
 #include "oss_site_config.h"
 
+#include <cstdint>
 #include <memory>
 
+// What identifies the content of a local file for the hash cache.
+struct HashKey {
+    int64_t device{-1};
+    int64_t inode{-1};
+    int64_t size{-1};
+    // Nanoseconds since the epoch.
+    int64_t mtime{-1};
+
+    bool operator==(const HashKey &) const = default;
+};
+
 class Storage {
 public:
     Storage();
@@ -27,6 +39,24 @@ public:
     // Will remove sub recursively
     void RemoveTask(const TaskPtr &task);
 
+    // The content ETag stored for path, if the file still has key. Safe to
+    // call from any thread, like StoreHash.
+    bool LookupHash(const std::string &path,
+                    const HashKey &key,
+                    std::string &etag);
+    void StoreHash(const std::string &path,
+                   const HashKey &key,
+                   const std::string &etag);
+
+    // The multipart ETag of an upload of path, added to the hash stored for
+    // key. Nothing is stored without that hash.
+    bool LookupPartHash(const std::string &path,
+                        const HashKey &key,
+                        std::string &partETag);
+    void StorePartHash(const std::string &path,
+                       const HashKey &key,
+                       const std::string &partETag);
+
 private:
     class Impl;
     std::unique_ptr<Impl> impl;
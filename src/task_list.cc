@@ -1,28 +1,70 @@
 #include "task_list.h"
 #include "directory_compare.h"
-#include "global_executor.h"
 #include "options.h"
 #include "oss_site.h"
 #include "osspanapp.h"
+#include "part_size_planner.h"
 #include "schedule_list.h"
 #include "storage.h"
 #include "traffic.h"
 #include "utils.h"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 
+// Queued tasks allowed per transfer thread before Submit(TaskPtrVec) waits.
+#define QUEUED_TASKS_PER_THREAD 64
+
+// Failed transfers are submitted again up to this many times, after 1, 2, 4
+// ... seconds.
+#define TASK_RETRIES 3
+
 TaskList *taskList() {
     static std::shared_ptr<TaskList> taskList(new TaskList);
     return taskList.get();
 }
 
 TaskList::TaskList() {
+    bool autotune = options().get_bool(OPTION_THREAD_AUTOTUNE);
+    int autotuneMax = options().get_int(OPTION_THREAD_AUTOTUNE_MAX);
     int downloadThreadCount = options().get_int(OPTION_DOWNLOAD_THREAD_COUNT);
-    tpDownload_.reset(new ScheduledThreadPoolExecutor(
-            downloadThreadCount / 2, downloadThreadCount, 1));
+    // With tuning, the options only give the starting concurrency.
+    int downloadThreadMax = autotune
+                                    ? std::max(downloadThreadCount, autotuneMax)
+                                    : downloadThreadCount;
+    tpDownload_.reset(new WorkStealingExecutor(downloadThreadMax));
+    tpDownload_->set_concurrency(downloadThreadCount);
+    int rangeConcurrency = options().get_int(OPTION_DOWNLOAD_PART_CONCURRENCY);
+    tpDownloadPart_.reset(new ScheduledThreadPoolExecutor(
+            rangeConcurrency, downloadThreadCount * rangeConcurrency));
     int uploadThreadCount = options().get_int(OPTION_UPLOAD_THREAD_COUNT);
-    tpUpload_.reset(new ScheduledThreadPoolExecutor(
-            uploadThreadCount / 2, uploadThreadCount, 1));
+    int uploadThreadMax = autotune ? std::max(uploadThreadCount, autotuneMax)
+                                   : uploadThreadCount;
+    tpUpload_.reset(new WorkStealingExecutor(uploadThreadMax));
+    tpUpload_->set_concurrency(uploadThreadCount);
+    int partConcurrency = options().get_int(OPTION_UPLOAD_PART_CONCURRENCY);
+    tpUploadPart_.reset(new ScheduledThreadPoolExecutor(
+            partConcurrency, uploadThreadCount * partConcurrency));
+    // Sized for the most threads tuning may run, so they do not starve.
+    tpDownload_->set_capacity(downloadThreadMax * QUEUED_TASKS_PER_THREAD);
+    tpUpload_->set_capacity(uploadThreadMax * QUEUED_TASKS_PER_THREAD);
+    tpSubmitDownload_.reset(new SingleThreadExecutor);
+    tpSubmitUpload_.reset(new SingleThreadExecutor);
+    tpDownload_->set_name("download");
+    tpDownloadPart_->set_name("download ranges");
+    tpUpload_->set_name("upload");
+    tpUploadPart_->set_name("upload parts");
+    tpSubmitDownload_->set_name("download submit");
+    tpSubmitUpload_->set_name("upload submit");
+    if (autotune) {
+        downloadTuner_.reset(new ConcurrencyController(
+                "download", tpDownload_.get(), 1, autotuneMax));
+        uploadTuner_.reset(new ConcurrencyController(
+                "upload", tpUpload_.get(), 1, autotuneMax));
+    }
     root_.reset(new Task);
     root_->type = TTRoot;
     root_->status = TSNone;
@@ -38,6 +80,50 @@ SitePtr createSite(const std::string &name) {
     }
     return std::make_shared<OssSite>(name);
 }
+
+/**
+ * Keeps at most size parts of one file in flight. The thread driving the
+ * transfer calls Acquire before submitting each part and Wait after the last
+ * one, every part calls Release when it is done.
+ */
+class PartWindow {
+public:
+    explicit PartWindow(size_t size) : size_(std::max<size_t>(size, 1)) {}
+
+    // Wait for a free slot, return false once any part has failed.
+    bool Acquire() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        cv_.wait(lck, [this]() { return inflight_ < size_ || !status_.ok(); });
+        if (!status_.ok()) {
+            return false;
+        }
+        inflight_++;
+        return true;
+    }
+
+    void Release(const Status &status) {
+        std::lock_guard<std::mutex> lck(mtx_);
+        inflight_--;
+        if (!status.ok() && status_.ok()) {
+            status_ = status;
+        }
+        cv_.notify_all();
+    }
+
+    // Wait for all parts in flight, return the first failure.
+    Status Wait() {
+        std::unique_lock<std::mutex> lck(mtx_);
+        cv_.wait(lck, [this]() { return inflight_ == 0; });
+        return status_;
+    }
+
+private:
+    const size_t size_;
+    size_t inflight_{0};
+    Status status_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+};
 } // namespace
 
 void TaskList::Attach(TaskListListener *listener) {
@@ -150,7 +236,13 @@ void TaskList::StopTask(const TaskPtr &task) {
     if (task->status < TSFinished) {
         if (task->children.empty()) {
             if (task->type != TTRoot && task->type != TTSite) {
-                task->stop = true;
+                task->stop.cancel();
+                // A retry waiting for its time stops at once.
+                if (task->retryTimer &&
+                    ExecutorOfTask(task)->cancel_timer(task->retryTimer)) {
+                    task->retryTimer = 0;
+                    TaskStopped(task);
+                }
             }
         } else {
             for (const auto &child : task->children) {
@@ -163,6 +255,7 @@ void TaskList::StopTask(const TaskPtr &task) {
 void TaskList::ResumeTask(const TaskPtr &task) {
     if (task->status == TSStopped) {
         task->status = TSPending;
+        task->retries = 0;
         // Resume only submit again when no children
         if (task->children.empty()) {
             Submit(task);
@@ -193,6 +286,9 @@ void TaskList::RestartTask(const TaskPtr &task) {
             parent->progress -= progress;
         }
         task->uploadId = "";
+        task->partSize = 0;
+        task->parts = "";
+        task->retries = 0;
         TaskUpdated(task);
         Submit(task);
     }
@@ -247,32 +343,106 @@ void TaskList::Load() {
 void TaskList::Close() {
     for (const auto &task : root_->children) {
     }
+    /*
+     * The tasks were stopped by the shutdown token, so the running ones only
+     * finish the step they are in. Queued tasks are dropped, but queued parts
+     * still run to release their windows, they return at once. Cancelling
+     * the pools also wakes the submitters waiting for queue space.
+     */
     tpDownload_->cancel();
-    tpDownload_.reset();
     tpUpload_->cancel();
+    tpSubmitDownload_->terminate();
+    tpSubmitUpload_->terminate();
+    tpSubmitDownload_.reset();
+    tpSubmitUpload_.reset();
+    downloadTuner_.reset();
+    uploadTuner_.reset();
+    tpDownload_.reset();
     tpUpload_.reset();
+    tpDownloadPart_.reset();
+    tpUploadPart_.reset();
+
+    // Store the parts and states the workers posted before they left.
+    wxTheApp->ProcessPendingEvents();
 }
 
-void TaskList::Submit(const TaskPtr &task) {
+Executor *TaskList::ExecutorOfTask(const TaskPtr &task) {
     // 只有明确的上传使用上传线程池
-    Executor *tp = tpDownload_.get();
     if (task->type == TTCopy &&
         (task->srcSite.empty() && !task->dstSite.empty())) {
-        tp = tpUpload_.get();
+        return tpUpload_.get();
+    }
+    return tpDownload_.get();
+}
+
+ConcurrencyController *TaskList::TunerOfTask(const TaskPtr &task) {
+    if (task->type != TTCopy && task->type != TTCopyPart) {
+        return nullptr;
+    }
+    if (ExecutorOfTask(task) == tpUpload_.get()) {
+        return uploadTuner_.get();
     }
-    tp->submit([this, task]() { Execute(task); });
+    return downloadTuner_.get();
+}
+
+void TaskList::Submit(const TaskPtr &task) {
+    ExecutorOfTask(task)->submit([this, task]() { Execute(task); });
 }
 
 void TaskList::Submit(const TaskPtrVec &tasks) {
     /*
      * If there are too many tasks, submit one by one may be slowly, so just
-     * submit the total pack, then submit the items.
+     * submit the total pack, then submit the items. The items wait for queue
+     * space, so a huge directory is fed to the pools as fast as they transfer
+     * rather than queued all at once. Each pool has a feeder of its own, a
+     * full download pool does not hold up the uploads behind it.
      */
-    globalExecutor()->submit([this, tasks]() {
-        for (const auto &t : tasks) {
-            Submit(t);
+    TaskPtrVec downloads, uploads;
+    for (const auto &t : tasks) {
+        if (ExecutorOfTask(t) == tpUpload_.get()) {
+            uploads.push_back(t);
+        } else {
+            downloads.push_back(t);
         }
-    });
+    }
+    auto feed = [this](Executor *feeder, Executor *executor, TaskPtrVec &&v) {
+        if (v.empty()) {
+            return;
+        }
+        feeder->submit([this, executor, v = std::move(v)]() {
+            auto execute = [this](const TaskPtr &t) { Execute(t); };
+            size_t n = executor->submit_range(
+                    Executor::kBulk, v.begin(), v.end(), execute);
+            // Left out by a stop of the pool, they would stay pending.
+            if (n < v.size()) {
+                TaskPtrVec left(v.begin() + n, v.end());
+                wxTheApp->CallAfter([this, left]() {
+                    for (const auto &t : left) {
+                        TaskStopped(t);
+                    }
+                });
+            }
+        });
+    };
+    feed(tpSubmitDownload_.get(), tpDownload_.get(), std::move(downloads));
+    feed(tpSubmitUpload_.get(), tpUpload_.get(), std::move(uploads));
+}
+
+bool TaskList::RetryTask(const TaskPtr &task) {
+    if ((task->type != TTCopy && task->type != TTCopyPart) ||
+        !task->children.empty() || task->retries >= TASK_RETRIES) {
+        return false;
+    }
+    auto delay = std::chrono::seconds(1) * (1 << task->retries);
+    task->retryTimer = ExecutorOfTask(task)->submit_after(
+            delay, Executor::kBackground, [this, task]() { Execute(task); });
+    if (!task->retryTimer) {
+        return false;
+    }
+    task->retries++;
+    task->status = TSPending;
+    TaskUpdated(task);
+    return true;
 }
 
 void TaskList::SubmitCopyFinish(const TaskPtr &task) {
@@ -284,7 +454,7 @@ void TaskList::SubmitCopyAbort(const TaskPtr &task) {
 }
 
 void TaskList::Execute(const TaskPtr &task) {
-    if (task->stop) {
+    if (task->stop.cancelled()) {
         wxTheApp->CallAfter([this, task]() { TaskStopped(task); });
         return;
     }
@@ -333,16 +503,21 @@ void TaskList::ExecuteSync(const TaskPtr &task,
     status = srcSite->GetDir(task->srcPath, srcDir);
     Traffic traffic(Direction::Recv);
     status = dstSite->GetDir(task->dstPath, dstDir);
+    std::vector<CmpResult> srcCmps;
+    std::vector<CmpResult> dstCmps;
     if (CompareDirectory(srcSite,
                          srcDir,
                          dstSite,
                          dstDir,
+                         srcCmps,
+                         dstCmps,
                          !(task->flag & SYNC_ONLY_NEW)) != 0) {
         // The compareDirectory may GetETag, so release traffic here.
         traffic.Release();
-        for (const auto &file : srcDir->files) {
+        for (size_t i = 0; i < srcDir->files.size(); i++) {
+            const auto &file = srcDir->files[i];
             if (file->type == FTDirectory && file->name != ".." &&
-                file->cmp == CSNone) {
+                srcCmps[i] == CSNone) {
                 // 如果是目录且没有明确相等或者不等，则继续比较
                 TaskPtr t(new Task);
                 t->type = TTSync;
@@ -360,8 +535,9 @@ void TaskList::ExecuteSync(const TaskPtr &task,
         }
 
         if (task->flag & SYNC_UP) {
-            for (const auto &file : srcDir->files) {
-                if (file->cmp == CSNew || file->cmp == CSUpdated) {
+            for (size_t i = 0; i < srcDir->files.size(); i++) {
+                const auto &file = srcDir->files[i];
+                if (srcCmps[i] == CSNew || srcCmps[i] == CSUpdated) {
                     TaskPtr t(new Task);
                     t->type = TTCopy;
                     t->status = TSPending;
@@ -378,8 +554,9 @@ void TaskList::ExecuteSync(const TaskPtr &task,
         }
 
         if (task->flag & SYNC_DOWN) {
-            for (const auto &file : dstDir->files) {
-                if (file->cmp == CSNew || file->cmp == CSUpdated) {
+            for (size_t i = 0; i < dstDir->files.size(); i++) {
+                const auto &file = dstDir->files[i];
+                if (dstCmps[i] == CSNew || dstCmps[i] == CSUpdated) {
                     TaskPtr t(new Task);
                     t->type = TTCopy;
                     t->status = TSPending;
@@ -403,9 +580,28 @@ void TaskList::ExecuteSync(const TaskPtr &task,
     }
 }
 
+// Files from this size are transferred in parts.
+#define MULTIPART_THRESHOLD (10 * 1000 * 1000)
+// The fixed part size of tasks saved before the part size was planned.
 #define SEGMENT (10 * 1000 * 1000)
-#define UPLOAD_THREADS 1
-#define DOWNLOAD_THREADS 1
+
+namespace {
+size_t PartSizeOfTask(const Task &task) {
+    return task.partSize ? task.partSize : SEGMENT;
+}
+
+/**
+ * Tasks saved before parts were recorded only have the progress, and their
+ * parts were always finished in order.
+ */
+std::string PartsOfTask(const Task &task, size_t nparts) {
+    if (task.parts.size() == nparts) {
+        return task.parts;
+    }
+    size_t done = std::min(task.progress / PartSizeOfTask(task), nparts);
+    return std::string(done, '1') + std::string(nparts - done, '0');
+}
+} // namespace
 
 void TaskList::ExecuteCopy(const TaskPtr &task,
                            const SitePtr &srcSite,
@@ -413,7 +609,7 @@ void TaskList::ExecuteCopy(const TaskPtr &task,
     if (task->srcPath.back() == '/') {
         ExecuteCopyDir(task, srcSite, dstSite);
     } else {
-        if (task->fileStat.size >= SEGMENT) {
+        if (task->fileStat.size >= MULTIPART_THRESHOLD) {
             ExecuteCopyBig(task, srcSite, dstSite);
         } else {
             Site *site =
@@ -487,6 +683,7 @@ void TaskList::ExecuteCopyBig(const TaskPtr &task,
     if (srcSite->type() == STLocal && dstSite->type() == STOss) {
         OssSite *ossSite = (OssSite *)dstSite.get();
         std::string uploadId = task->uploadId;
+        size_t partSize = PartSizeOfTransfer(task, Direction::Send);
         if (uploadId.empty()) {
             Traffic traffic(Direction::Send);
             Status status = ossSite->InitMultipartUpload(
@@ -501,74 +698,12 @@ void TaskList::ExecuteCopyBig(const TaskPtr &task,
                 return;
             }
         }
-        int nthreads = UPLOAD_THREADS;
-        if (nthreads == 1) {
-            // The uploadId have not been written to task, so pass it.
-            ExecuteCopyFromLocalSegments(task, uploadId, srcSite, dstSite);
-            return;
-        } else {
-            size_t perThreadSize = task->fileStat.size / nthreads;
-            size_t perThreadParts = perThreadSize / SEGMENT;
-            TaskPtrVec parts;
-            for (int i = 0; i < nthreads; i++) {
-                size_t size = i < nthreads - 1
-                                      ? perThreadSize
-                                      : perThreadSize +
-                                                task->fileStat.size % nthreads;
-                TaskPtr t(new Task);
-                t->type = TTCopyPart;
-                t->status = TSPending;
-                t->srcSite = task->srcSite;
-                t->srcPath = task->srcPath;
-                t->dstSite = task->dstSite;
-                t->dstPath = task->dstPath;
-                t->fileStat = {size, 0};
-                t->uploadId = uploadId;
-                t->offset = perThreadSize * i;
-                t->partId = perThreadParts * i;
-                t->parentId = task->id;
-                t->parent = task;
-                parts.push_back(t);
-            }
-            wxTheApp->CallAfter(
-                    [this, task, parts]() { AddTask(task, parts); });
-        }
+        // The uploadId have not been written to task, so pass it.
+        ExecuteCopyFromLocalSegments(
+                task, uploadId, partSize, srcSite, dstSite);
         return;
     } else if (srcSite->type() == STOss && dstSite->type() == STLocal) {
-        int nthreads = DOWNLOAD_THREADS;
-        if (nthreads == 1) {
-            ExecuteCopyToLocalSegments(task, srcSite, dstSite);
-        } else {
-            size_t perThreadSize = task->fileStat.size / nthreads;
-            std::string dstPath =
-                    std::filesystem::path(task->dstPath)
-                            .parent_path()
-                            .string() +
-                    std::string("/.") +
-                    std::filesystem::path(task->dstPath).filename().string() +
-                    ".osspanpart.";
-            TaskPtrVec parts;
-            for (int i = 0; i < nthreads; i++) {
-                size_t size = perThreadSize;
-                if (i == nthreads - 1) {
-                    size += task->fileStat.size % nthreads;
-                }
-                TaskPtr t(new Task);
-                t->type = TTCopyPart;
-                t->status = TSPending;
-                t->srcSite = task->srcSite;
-                t->srcPath = task->srcPath;
-                t->dstSite = task->dstSite;
-                t->dstPath = dstPath + std::to_string(i + 1);
-                t->fileStat = {size, 0};
-                t->offset = perThreadSize * i;
-                t->parentId = task->id;
-                t->parent = task;
-                parts.push_back(t);
-            }
-            wxTheApp->CallAfter(
-                    [this, task, parts]() { AddTask(task, parts); });
-        }
+        ExecuteCopyToLocalSegments(task, srcSite, dstSite);
         return;
     }
     assert(0); // TODO.
@@ -576,42 +711,86 @@ void TaskList::ExecuteCopyBig(const TaskPtr &task,
 
 void TaskList::ExecuteCopyFromLocalSegments(const TaskPtr &task,
                                             const std::string &uploadId,
+                                            size_t partSize,
                                             const SitePtr &srcSite,
                                             const SitePtr &dstSite) {
     OssSite *ossSite = (OssSite *)dstSite.get();
-    size_t nparts = task->fileStat.size / SEGMENT;
-    size_t partId = task->progress / SEGMENT;
-    for (; partId < nparts; partId++) {
+    // Round up so the last part holds the remainder instead of growing past
+    // partSize, an empty file is still uploaded as one part.
+    size_t nparts = std::max<size_t>(
+            (task->fileStat.size + partSize - 1) / partSize, 1);
+    std::string parts = PartsOfTask(*task, nparts);
+    auto window = std::make_shared<PartWindow>(
+            options().get_int(OPTION_UPLOAD_PART_CONCURRENCY));
+    bool stopped = false;
+    for (size_t partId = 0; partId < nparts; partId++) {
+        if (parts[partId] == '1') {
+            continue;
+        }
         // Give a chance to leave.
-        if (task->stop) {
-            wxTheApp->CallAfter([this, task]() { TaskStopped(task); });
-            return;
+        if (task->stop.cancelled()) {
+            stopped = true;
+            break;
         }
-        size_t offset = partId * SEGMENT;
-        size_t size =
-                partId < nparts - 1 ? SEGMENT : (task->fileStat.size - offset);
-        Traffic traffic(Direction::Send);
-        Status status =
-                ossSite->CopyFileFromLocalPart(task->srcPath,
-                                               task->dstPath,
-                                               uploadId,
-                                               task->partId + partId + 1,
-                                               task->offset + offset,
-                                               size);
-        if (status.ok()) {
-            wxTheApp->CallAfter(
-                    [this, task, size]() { TaskProgressUpdated(task, size); });
-        } else {
-            wxTheApp->CallAfter(
-                    [this, task, status]() { TaskFailed(task, status); });
-            return;
+        if (!window->Acquire()) {
+            break;
         }
+        size_t offset = partId * partSize;
+        size_t size =
+                partId < nparts - 1 ? partSize : (task->fileStat.size - offset);
+        tpUploadPart_->submit([this,
+                               task,
+                               dstSite,
+                               window,
+                               uploadId,
+                               nparts,
+                               partId,
+                               offset,
+                               size]() {
+            if (task->stop.cancelled()) {
+                window->Release(Status::OK());
+                return;
+            }
+            OssSite *ossSite = (OssSite *)dstSite.get();
+            Traffic traffic(Direction::Send);
+            auto start = std::chrono::steady_clock::now();
+            Status status =
+                    ossSite->CopyFileFromLocalPart(task->srcPath,
+                                                   task->dstPath,
+                                                   uploadId,
+                                                   task->partId + partId + 1,
+                                                   task->offset + offset,
+                                                   size);
+            traffic.Release();
+            if (status.ok()) {
+                std::chrono::duration<double> elapsed =
+                        std::chrono::steady_clock::now() - start;
+                partThroughput()->Record(
+                        Direction::Send, size, elapsed.count());
+                wxTheApp->CallAfter([this, task, nparts, partId, size]() {
+                    TaskPartFinished(task, nparts, partId, size);
+                });
+            }
+            window->Release(status);
+        });
+    }
+
+    // Parts skipped or aborted by a stop leave the task stopped, not failed.
+    Status status = window->Wait();
+    if (stopped || task->stop.cancelled()) {
+        wxTheApp->CallAfter([this, task]() { TaskStopped(task); });
+        return;
+    }
+    if (!status.ok()) {
+        wxTheApp->CallAfter(
+                [this, task, status]() { TaskFailed(task, status); });
+        return;
     }
 
-    Status status = Status::OK();
     if (task->type == TTCopy) {
         Traffic traffic(Direction::Send);
-        status = ossSite->CopyFileFromLocalPartFinish(task->dstPath, uploadId);
+        status = ossSite->CopyFileFromLocalPartFinish(
+                task->srcPath, task->fileStat, task->dstPath, uploadId);
     }
     if (status.ok()) {
         wxTheApp->CallAfter([this, task]() { TaskFinished(task, 0); });
@@ -624,46 +803,93 @@ void TaskList::ExecuteCopyFromLocalSegments(const TaskPtr &task,
 void TaskList::ExecuteCopyToLocalSegments(const TaskPtr &task,
                                           const SitePtr &srcSite,
                                           const SitePtr &dstSite) {
-    size_t progress = task->progress;
-    if (std::filesystem::exists(task->dstPath)) {
-        size_t fsize = std::filesystem::file_size(task->dstPath);
-        if (fsize > progress) {
-            std::filesystem::resize_file(task->dstPath, progress);
-        } else if (fsize < progress) {
-            std::filesystem::resize_file(task->dstPath, 0);
-            wxTheApp->CallAfter([this, task, progress]() {
-                TaskProgressUpdated(task, -(int64_t)progress);
-            });
-            progress = 0;
-        }
-    }
-
-    OssSite *ossSite = (OssSite *)srcSite.get();
-    size_t nparts = std::ceil((double)task->fileStat.size / SEGMENT);
-    size_t n = std::ceil((double)progress / SEGMENT);
-    std::shared_ptr<std::fstream> out(
-            new std::fstream(task->dstPath, std::ios::binary | std::ios::app));
-    for (; n < nparts; n++) {
-        if (task->stop) {
-            wxTheApp->CallAfter([this, task]() { TaskStopped(task); });
-            return;
+    size_t partSize = PartSizeOfTransfer(task, Direction::Recv);
+    size_t nparts = std::ceil((double)task->fileStat.size / partSize);
+    std::string parts = PartsOfTask(*task, nparts);
+
+    // The file is sized in full once opened, so only the recorded parts tell
+    // what was downloaded, and they are lost with the file.
+    bool fresh = parts.find('1') == std::string::npos;
+    if (!fresh && !std::filesystem::exists(task->dstPath)) {
+        fresh = true;
+        parts.assign(nparts, '0');
+        wxTheApp->CallAfter([this, task]() { TaskPartsReset(task); });
+    }
+
+    int fd;
+    Status status = LocalSite::OpenPreallocated(
+            task->dstPath, task->fileStat.size, fresh, fd);
+    if (!status.ok()) {
+        wxTheApp->CallAfter(
+                [this, task, status]() { TaskFailed(task, status); });
+        return;
+    }
+
+    auto window = std::make_shared<PartWindow>(
+            options().get_int(OPTION_DOWNLOAD_PART_CONCURRENCY));
+    bool stopped = false;
+    for (size_t n = 0; n < nparts; n++) {
+        if (parts[n] == '1') {
+            continue;
         }
-        size_t offset = n * SEGMENT;
-        size_t size = n < nparts - 1 ? SEGMENT : (task->fileStat.size - offset);
-        Traffic traffic(Direction::Recv);
-        Status status =
-                ossSite->CopyFileToLocalPart(out,
-                                             task->srcPath,
-                                             task->offset + offset,
-                                             task->offset + offset + size - 1);
-        if (status.ok()) {
-            wxTheApp->CallAfter(
-                    [this, task, size]() { TaskProgressUpdated(task, size); });
-        } else {
-            wxTheApp->CallAfter(
-                    [this, task, status]() { TaskFailed(task, status); });
-            return;
+        if (task->stop.cancelled()) {
+            stopped = true;
+            break;
         }
+        if (!window->Acquire()) {
+            break;
+        }
+        size_t offset = n * partSize;
+        size_t size =
+                n < nparts - 1 ? partSize : (task->fileStat.size - offset);
+        tpDownloadPart_->submit([this,
+                                 task,
+                                 srcSite,
+                                 window,
+                                 fd,
+                                 nparts,
+                                 n,
+                                 offset,
+                                 size]() {
+            if (task->stop.cancelled()) {
+                window->Release(Status::OK());
+                return;
+            }
+            OssSite *ossSite = (OssSite *)srcSite.get();
+            Traffic traffic(Direction::Recv);
+            auto start = std::chrono::steady_clock::now();
+            Status status = ossSite->CopyFileToLocalPart(
+                    fd,
+                    offset,
+                    task->srcPath,
+                    task->offset + offset,
+                    task->offset + offset + size - 1,
+                    task->stop);
+            traffic.Release();
+            if (status.ok()) {
+                std::chrono::duration<double> elapsed =
+                        std::chrono::steady_clock::now() - start;
+                partThroughput()->Record(
+                        Direction::Recv, size, elapsed.count());
+                wxTheApp->CallAfter([this, task, nparts, n, size]() {
+                    TaskPartFinished(task, nparts, n, size);
+                });
+            }
+            window->Release(status);
+        });
+    }
+
+    // No range is in flight after Wait, so fd can be closed.
+    status = window->Wait();
+    ::close(fd);
+    if (stopped || task->stop.cancelled()) {
+        wxTheApp->CallAfter([this, task]() { TaskStopped(task); });
+        return;
+    }
+    if (!status.ok()) {
+        wxTheApp->CallAfter(
+                [this, task, status]() { TaskFailed(task, status); });
+        return;
     }
 
     if (task->type == TTCopy) {
@@ -674,18 +900,42 @@ void TaskList::ExecuteCopyToLocalSegments(const TaskPtr &task,
     wxTheApp->CallAfter([this, task]() { TaskFinished(task, 0); });
 }
 
+/**
+ * The part size of a transfer is planned when it starts and then kept, the
+ * recorded parts are only meaningful with the part size they were made with.
+ */
+size_t TaskList::PartSizeOfTransfer(const TaskPtr &task,
+                                    Direction direction) {
+    if (task->partSize) {
+        return task->partSize;
+    }
+    if (task->type == TTCopyPart || task->progress || !task->parts.empty() ||
+        (direction == Direction::Send && !task->uploadId.empty())) {
+        return SEGMENT;
+    }
+    double bytesPerSecond = partThroughput()->BytesPerSecond(direction);
+    size_t partSize = PlanPartSize(task->fileStat.size, bytesPerSecond);
+    // Posted before any part finishes, so the parts map is always built
+    // with this size.
+    wxTheApp->CallAfter(
+            [this, task, partSize]() { TaskPartSizePlanned(task, partSize); });
+    return partSize;
+}
+
 void TaskList::ExecuteCopyPart(const TaskPtr &task,
                                const SitePtr &srcSite,
                                const SitePtr &dstSite) {
     if (srcSite->type() == STLocal) {
-        ExecuteCopyFromLocalSegments(task, task->uploadId, srcSite, dstSite);
+        size_t partSize = PartSizeOfTransfer(task, Direction::Send);
+        ExecuteCopyFromLocalSegments(
+                task, task->uploadId, partSize, srcSite, dstSite);
     } else {
         ExecuteCopyToLocalSegments(task, srcSite, dstSite);
     }
 }
 
 void TaskList::ExecuteCopyFinish(const TaskPtr &task) {
-    if (task->stop) {
+    if (task->stop.cancelled()) {
         wxTheApp->CallAfter([this, task]() { TaskStopped(task); });
         return;
     }
@@ -701,8 +951,8 @@ void TaskList::ExecuteCopyFinish(const TaskPtr &task) {
     Status status;
     if (srcSite->type() == STLocal) {
         OssSite *ossSite = (OssSite *)dstSite.get();
-        status = ossSite->CopyFileFromLocalPartFinish(task->dstPath,
-                                                      task->uploadId);
+        status = ossSite->CopyFileFromLocalPartFinish(
+                task->srcPath, task->fileStat, task->dstPath, task->uploadId);
     } else {
         LocalSite *localSite = (LocalSite *)dstSite.get();
         status = localSite->ConcatParts(task->dstPath, task->children.size());
@@ -751,6 +1001,11 @@ void TaskList::TaskFinished(const TaskPtr &task, size_t progress, size_t size) {
     task->fileStat.size += amend;
     TaskUpdated(task);
 
+    if (auto *tuner = TunerOfTask(task)) {
+        tuner->AddBytes(progress);
+        tuner->AddResult(false);
+    }
+
     TaskPtr parent = task;
     bool allDone = true;
     for (;;) {
@@ -799,7 +1054,7 @@ void TaskList::TaskFinished(const TaskPtr &task, size_t progress, size_t size) {
 void TaskList::TaskStopped(const TaskPtr &task) {
     std::time_t tm = std::time(nullptr);
     task->status = TSStopped;
-    task->stop = false;
+    task->stop.reset();
     task->finishTime = tm;
     TaskUpdated(task);
 
@@ -838,6 +1093,21 @@ void TaskList::TaskStopped(const TaskPtr &task) {
 }
 
 void TaskList::TaskFailed(const TaskPtr &task, const Status &status) {
+    // Requests aborted by a stop fail, but the task was only stopped.
+    if (task->stop.cancelled()) {
+        TaskStopped(task);
+        return;
+    }
+
+    if (auto *tuner = TunerOfTask(task)) {
+        tuner->AddResult(true);
+    }
+
+    // Timeouts and throttled requests often pass, resumed a bit later.
+    if (RetryTask(task)) {
+        return;
+    }
+
     std::time_t tm = std::time(nullptr);
     task->status = TSFailed;
     task->finishTime = tm;
@@ -889,6 +1159,11 @@ void TaskList::TaskProgressUpdated(const TaskPtr &task, int64_t progress) {
     task->progress += progress;
     TaskUpdated(task);
 
+    auto *tuner = TunerOfTask(task);
+    if (tuner && progress > 0) {
+        tuner->AddBytes(progress);
+    }
+
     for (TaskPtr parent = task->parent.lock(); parent && parent->type != TTSite;
          parent = parent->parent.lock()) {
         parent->progress += progress;
@@ -896,6 +1171,27 @@ void TaskList::TaskProgressUpdated(const TaskPtr &task, int64_t progress) {
     }
 }
 
+void TaskList::TaskPartFinished(const TaskPtr &task,
+                                size_t nparts,
+                                size_t part,
+                                size_t size) {
+    if (task->parts.size() != nparts) {
+        task->parts = PartsOfTask(*task, nparts);
+    }
+    task->parts[part] = '1';
+    TaskProgressUpdated(task, size);
+}
+
+void TaskList::TaskPartSizePlanned(const TaskPtr &task, size_t partSize) {
+    task->partSize = partSize;
+    TaskUpdated(task);
+}
+
+void TaskList::TaskPartsReset(const TaskPtr &task) {
+    task->parts = "";
+    TaskProgressUpdated(task, -(int64_t)task->progress);
+}
+
 void TaskList::TaskAdded(const TaskPtr &parent, const TaskPtr &task) {
     storage()->AppendTask(task);
     for (auto *l : listeners_) {
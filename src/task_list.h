@@ -4,9 +4,12 @@
 #include <string>
 #include <vector>
 
+#include "cancellation.h"
+#include "concurrency_controller.h"
 #include "executor.h"
 #include "local_site.h"
 #include "oss_site.h"
+#include "traffic.h"
 
 enum TaskType {
     TTRoot,
@@ -50,7 +53,8 @@ struct Task : public std::enable_shared_from_this<Task> {
     long scheduleId{0};
     TaskType type;
     TaskStatus status;
-    std::atomic<bool> stop{false};
+    // Cancelled to stop the task, and when the application closes.
+    CancellationToken stop{shutdownToken().child()};
     std::string srcSite;
     std::string srcPath;
     std::string dstSite;
@@ -61,8 +65,16 @@ struct Task : public std::enable_shared_from_this<Task> {
     size_t offset{0};
     size_t partId{0};
     size_t progress{0};
+    // Part size of a multipart transfer, chosen once and kept for resume.
+    size_t partSize{0};
+    // One char per part of a multipart transfer, '1' once the part is done.
+    std::string parts;
     std::time_t startTime{0};
     std::time_t finishTime{0};
+    // Retries after failures and the timer of the next one, not stored, a
+    // loaded task starts counting again.
+    int retries{0};
+    Executor::TimerId retryTimer{0};
 
     TaskPtrVec children;
     TaskWeakPtr parent;
@@ -136,6 +148,15 @@ public:
 
     void TaskProgressUpdated(const TaskPtr &task, int64_t progress);
 
+    void TaskPartFinished(const TaskPtr &task,
+                          size_t nparts,
+                          size_t part,
+                          size_t size);
+
+    void TaskPartsReset(const TaskPtr &task);
+
+    void TaskPartSizePlanned(const TaskPtr &task, size_t partSize);
+
     void StopTask(const TaskPtr &task);
 
     void ResumeTask(const TaskPtr &task);
@@ -152,8 +173,13 @@ public:
     void RemoveFinishedTasks();
 
 protected:
+    Executor *ExecutorOfTask(const TaskPtr &task);
+    // The tuner of the pool running task, if tuning is enabled.
+    ConcurrencyController *TunerOfTask(const TaskPtr &task);
     void Submit(const TaskPtr &task);
     void Submit(const TaskPtrVec &tasks);
+    // Submit a failed transfer again after a backoff, false if it is not.
+    bool RetryTask(const TaskPtr &task);
     void SubmitCopyFinish(const TaskPtr &task);
     void SubmitCopyAbort(const TaskPtr &task);
     void Execute(const TaskPtr &task);
@@ -174,11 +200,13 @@ protected:
                          const SitePtr &dstSite);
     void ExecuteCopyFromLocalSegments(const TaskPtr &task,
                                       const std::string &uploadId,
+                                      size_t partSize,
                                       const SitePtr &srcSite,
                                       const SitePtr &dstSite);
     void ExecuteCopyToLocalSegments(const TaskPtr &task,
                                     const SitePtr &srcSite,
                                     const SitePtr &dstSite);
+    size_t PartSizeOfTransfer(const TaskPtr &task, Direction direction);
     void ExecuteCopyFinish(const TaskPtr &task);
     void ExecuteCopyAbort(const TaskPtr &task);
 
@@ -188,8 +216,21 @@ protected:
     void TaskRemoved(const TaskPtr &Task);
 
 private:
-    std::shared_ptr<Executor> tpDownload_;
-    std::shared_ptr<Executor> tpUpload_;
+    std::shared_ptr<WorkStealingExecutor> tpDownload_;
+    std::shared_ptr<WorkStealingExecutor> tpUpload_;
+    // Tune the running workers of tpDownload_ and tpUpload_ between one and
+    // OPTION_THREAD_AUTOTUNE_MAX, when OPTION_THREAD_AUTOTUNE is set.
+    std::unique_ptr<ConcurrencyController> downloadTuner_;
+    std::unique_ptr<ConcurrencyController> uploadTuner_;
+    // Runs the parts of multipart uploads, so that the uploading thread can
+    // keep several parts in flight without blocking tpUpload_ itself.
+    std::shared_ptr<Executor> tpUploadPart_;
+    // Runs the ranges of multipart downloads.
+    std::shared_ptr<Executor> tpDownloadPart_;
+    // Feed batches of tasks to tpDownload_ and tpUpload_, waiting whenever
+    // theirs is full, one each so a full pool does not hold up the other.
+    std::shared_ptr<Executor> tpSubmitDownload_;
+    std::shared_ptr<Executor> tpSubmitUpload_;
 
     TaskPtr root_;
     std::vector<TaskListListener *> listeners_;
@@ -0,0 +1,211 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <bit>
+
+TimerWheel *timerWheel() {
+    static TimerWheel wheel;
+    return &wheel;
+}
+
+TimerWheel::TimerWheel(Clock::duration tick)
+    : tick_(std::max<Clock::duration>(tick, Clock::duration(1))),
+      start_(Clock::now()) {
+}
+
+TimerWheel::~TimerWheel() {
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        stopping_ = true;
+        cv_.notify_all();
+    }
+    if (th_.joinable()) {
+        th_.join();
+    }
+}
+
+TimerWheel::TimerId TimerWheel::Add(Clock::time_point due,
+                                    Callback callback,
+                                    const void *owner) {
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (stopping_) {
+        return 0;
+    }
+    if (!th_.joinable()) {
+        th_ = std::thread([this]() { Run(); });
+    }
+    TimerId id = nextId_++;
+    uint64_t tick = TickOf(due);
+    Slot added;
+    added.push_back({id, tick, owner, std::move(callback)});
+    Place(added, added.begin());
+    if (tick < wake_) {
+        cv_.notify_one();
+    }
+    return id;
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+    // Destroyed after the lock is released, it may own anything.
+    Slot dropped;
+    std::lock_guard<std::mutex> lck(mtx_);
+    auto found = timers_.find(id);
+    if (found == timers_.end()) {
+        return false;
+    }
+    const Location &location = found->second;
+    Slot &slot = SlotOf(location);
+    dropped.splice(dropped.end(), slot, location.it);
+    if (location.level < kLevels && slot.empty()) {
+        occupied_[location.level] &= ~(uint64_t(1) << location.slot);
+    }
+    timers_.erase(found);
+    return true;
+}
+
+size_t TimerWheel::CancelOwner(const void *owner) {
+    Slot dropped;
+    {
+        std::unique_lock<std::mutex> lck(mtx_);
+        for (auto it = timers_.begin(); it != timers_.end();) {
+            const Location &location = it->second;
+            if (location.it->owner != owner) {
+                ++it;
+                continue;
+            }
+            Slot &slot = SlotOf(location);
+            dropped.splice(dropped.end(), slot, location.it);
+            if (location.level < kLevels && slot.empty()) {
+                occupied_[location.level] &= ~(uint64_t(1) << location.slot);
+            }
+            it = timers_.erase(it);
+        }
+        // Timers taken out to fire are not found, wait for them. A callback
+        // calling it would wait for itself.
+        if (std::this_thread::get_id() != th_.get_id()) {
+            firedCv_.wait(lck, [this]() { return !firing_; });
+        }
+    }
+    return dropped.size();
+}
+
+size_t TimerWheel::size() const {
+    std::lock_guard<std::mutex> lck(mtx_);
+    return timers_.size();
+}
+
+void TimerWheel::Run() {
+    std::unique_lock<std::mutex> lck(mtx_);
+    while (!stopping_) {
+        Advance((Clock::now() - start_) / tick_);
+        if (!ready_.empty()) {
+            Slot firing;
+            firing.splice(firing.end(), ready_);
+            for (const auto &timer : firing) {
+                timers_.erase(timer.id);
+            }
+            firing_ = true;
+            lck.unlock();
+            for (auto &timer : firing) {
+                timer.callback();
+            }
+            firing.clear();
+            lck.lock();
+            firing_ = false;
+            firedCv_.notify_all();
+            continue;
+        }
+        wake_ = NextTick();
+        if (wake_ == UINT64_MAX) {
+            cv_.wait(lck);
+        } else {
+            cv_.wait_until(lck, start_ + tick_ * wake_);
+        }
+        wake_ = UINT64_MAX;
+    }
+}
+
+void TimerWheel::Advance(uint64_t tick) {
+    while (now_ < tick) {
+        uint64_t next = NextTick();
+        if (next > tick) {
+            now_ = tick;
+            break;
+        }
+        now_ = next;
+        // Higher levels first, their timers may be due right now.
+        for (int level = kLevels - 1; level >= 0; level--) {
+            int shift = kBits * level;
+            if (now_ & ((uint64_t(1) << shift) - 1)) {
+                continue;
+            }
+            size_t slot = (now_ >> shift) & (kSlots - 1);
+            uint64_t bit = uint64_t(1) << slot;
+            if (!(occupied_[level] & bit)) {
+                continue;
+            }
+            occupied_[level] &= ~bit;
+            Slot moving;
+            moving.splice(moving.end(), slots_[level][slot]);
+            while (!moving.empty()) {
+                Place(moving, moving.begin());
+            }
+        }
+    }
+}
+
+void TimerWheel::Place(Slot &from, Slot::iterator it) {
+    Location location{kLevels, 0, it};
+    uint64_t due = it->due;
+    if (due > now_) {
+        // The lowest level whose slots reach due from now_.
+        uint64_t delta = due - now_;
+        int level = 0;
+        while (level + 1 < kLevels && (delta >> (kBits * (level + 1))) != 0) {
+            level++;
+        }
+        int shift = kBits * level;
+        uint64_t index = due >> shift;
+        if ((delta >> (kBits * kLevels)) != 0) {
+            index = (now_ >> shift) + kSlots - 1;
+        }
+        location.level = level;
+        location.slot = index & (kSlots - 1);
+        occupied_[level] |= uint64_t(1) << location.slot;
+    }
+    Slot &to = SlotOf(location);
+    to.splice(to.end(), from, it);
+    timers_[it->id] = location;
+}
+
+uint64_t TimerWheel::NextTick() const {
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < kLevels; level++) {
+        if (!occupied_[level]) {
+            continue;
+        }
+        // The slots of a level are reached in order from the one after now_,
+        // a slot at the start of its span.
+        int shift = kBits * level;
+        uint64_t first = (now_ >> shift) + 1;
+        uint64_t bits =
+                std::rotr(occupied_[level], int(first & (kSlots - 1)));
+        uint64_t tick = (first + std::countr_zero(bits)) << shift;
+        next = std::min(next, tick);
+    }
+    return next;
+}
+
+uint64_t TimerWheel::TickOf(Clock::time_point time) const {
+    if (time <= start_) {
+        return 0;
+    }
+    return ((time - start_) + tick_ - Clock::duration(1)) / tick_;
+}
+
+TimerWheel::Slot &TimerWheel::SlotOf(const Location &location) {
+    if (location.level == kLevels) {
+        return ready_;
+    }
+    return slots_[location.level][location.slot];
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "unique_task.h"
+
+/**
+ * Runs callbacks at a point in time, in a thread of its own. The timers are
+ * kept in a hierarchical wheel: level 0 has one slot per tick for the next
+ * kSlots ticks, each higher level has slots kSlots times as wide as the
+ * level below, and a slot of a higher level is spread over the lower levels
+ * when the wheel reaches it. Adding and cancelling a timer is O(1), and the
+ * thread sleeps until the next slot that holds a timer.
+ * Callbacks must return quickly and hand real work to an executor, which is
+ * what Executor::submit_after does.
+ */
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimerId = uint64_t;
+    using Callback = UniqueTask;
+
+    explicit TimerWheel(
+            Clock::duration tick = std::chrono::milliseconds(1));
+
+    ~TimerWheel();
+
+    /**
+     * Run callback once due passed, at once if it already did. Timers are
+     * never early and at most a tick late. owner only tags the timer for
+     * CancelOwner. The thread is started by the first timer.
+     */
+    TimerId Add(Clock::time_point due,
+                Callback callback,
+                const void *owner = nullptr);
+
+    // Drop a timer that has not fired yet, return whether it was dropped.
+    bool Cancel(TimerId id);
+
+    /**
+     * Drop every timer of owner and wait for callbacks firing meanwhile, no
+     * callback of owner runs after it returns. Returns the dropped timers.
+     */
+    size_t CancelOwner(const void *owner);
+
+    // Timers not fired yet.
+    size_t size() const;
+
+private:
+    static constexpr int kBits = 6;
+    static constexpr size_t kSlots = size_t(1) << kBits;
+    // With 1ms ticks the levels cover about two years, timers further out
+    // wait in the last slot of the top level and are placed again from there.
+    static constexpr int kLevels = 6;
+
+    struct Timer {
+        TimerId id;
+        uint64_t due;
+        const void *owner;
+        Callback callback;
+    };
+    using Slot = std::list<Timer>;
+
+    struct Location {
+        // kLevels for timers in ready_.
+        int level;
+        size_t slot;
+        Slot::iterator it;
+    };
+
+    void Run();
+
+    // Turn the wheel up to tick, moving the due timers to ready_.
+    void Advance(uint64_t tick);
+
+    // Move the timer at it of from to its slot for now_, or to ready_.
+    void Place(Slot &from, Slot::iterator it);
+
+    // The next tick at which a slot holding timers is reached.
+    uint64_t NextTick() const;
+
+    // The first tick at or after time.
+    uint64_t TickOf(Clock::time_point time) const;
+
+    Slot &SlotOf(const Location &location);
+
+    const Clock::duration tick_;
+    const Clock::time_point start_;
+
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    Slot slots_[kLevels][kSlots];
+    // One bit per slot holding timers.
+    uint64_t occupied_[kLevels]{};
+    Slot ready_;
+    std::unordered_map<TimerId, Location> timers_;
+    TimerId nextId_{1};
+    // The tick the wheel is at, every timer due until it is in ready_.
+    uint64_t now_{0};
+    // The tick the thread sleeps until, Add wakes it for earlier timers.
+    uint64_t wake_{UINT64_MAX};
+    bool stopping_{false};
+    // Callbacks run without mtx_, CancelOwner waits for them on firedCv_.
+    bool firing_{false};
+    std::condition_variable firedCv_;
+    std::thread th_;
+};
+
+// The timer wheel of the process, used by the executors for delayed tasks.
+TimerWheel *timerWheel();
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A move only void() callable for the queues of the executors. Callables up
+ * to kInlineSize bytes, like a closure holding this and a TaskPtr, are kept
+ * inside the object, larger ones on the heap. Unlike std::function it never
+ * copies what it holds, so closures may own move only state.
+ */
+class UniqueTask {
+public:
+    static constexpr size_t kInlineSize = 56;
+
+    UniqueTask() noexcept = default;
+
+    template <typename F,
+              typename = std::enable_if_t<
+                      !std::is_same_v<std::decay_t<F>, UniqueTask>>>
+    UniqueTask(F &&f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (IsInline<Fn>()) {
+            new (buf_) Fn(std::forward<F>(f));
+            ops_ = &kInlineOps<Fn>;
+        } else {
+            *reinterpret_cast<Fn **>(buf_) = new Fn(std::forward<F>(f));
+            ops_ = &kHeapOps<Fn>;
+        }
+    }
+
+    UniqueTask(UniqueTask &&other) noexcept { MoveFrom(other); }
+
+    UniqueTask &operator=(UniqueTask &&other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    UniqueTask(const UniqueTask &) = delete;
+    UniqueTask &operator=(const UniqueTask &) = delete;
+
+    ~UniqueTask() { Reset(); }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    void operator()() { ops_->invoke(buf_); }
+
+private:
+    struct Ops {
+        void (*invoke)(void *buf);
+        // Move the callable of src to the empty dst and destroy it in src.
+        void (*relocate)(void *dst, void *src) noexcept;
+        void (*destroy)(void *buf) noexcept;
+    };
+
+    template <typename Fn>
+    static constexpr bool IsInline() {
+        return sizeof(Fn) <= kInlineSize &&
+               alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<Fn>;
+    }
+
+    template <typename Fn>
+    static constexpr Ops kInlineOps = {
+            [](void *buf) { (*std::launder(static_cast<Fn *>(buf)))(); },
+            [](void *dst, void *src) noexcept {
+                Fn *fn = std::launder(static_cast<Fn *>(src));
+                new (dst) Fn(std::move(*fn));
+                fn->~Fn();
+            },
+            [](void *buf) noexcept {
+                std::launder(static_cast<Fn *>(buf))->~Fn();
+            },
+    };
+
+    template <typename Fn>
+    static constexpr Ops kHeapOps = {
+            [](void *buf) { (**static_cast<Fn **>(buf))(); },
+            [](void *dst, void *src) noexcept {
+                *static_cast<Fn **>(dst) = *static_cast<Fn **>(src);
+            },
+            [](void *buf) noexcept { delete *static_cast<Fn **>(buf); },
+    };
+
+    void MoveFrom(UniqueTask &other) noexcept {
+        if (other.ops_) {
+            other.ops_->relocate(buf_, other.buf_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    void Reset() noexcept {
+        if (ops_) {
+            ops_->destroy(buf_);
+            ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char buf_[kInlineSize];
+    const Ops *ops_{nullptr};
+};